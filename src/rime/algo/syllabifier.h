@@ -25,14 +25,16 @@ struct EdgeProperties : SpellingProperties {
   bool is_correction = false;
 };
 
-using SpellingMap = map<SyllableId, EdgeProperties>;
-using VertexMap = map<size_t, SpellingType>;
-using EndVertexMap = map<size_t, SpellingMap>;
-using EdgeMap = map<size_t, EndVertexMap>;
+// the syllable graph is rebuilt on every keystroke; its nodes are taken
+// from the arena of the menu being translated, if any.
+using SpellingMap = arena_map<SyllableId, EdgeProperties>;
+using VertexMap = arena_map<size_t, SpellingType>;
+using EndVertexMap = arena_map<size_t, SpellingMap>;
+using EdgeMap = arena_map<size_t, EndVertexMap>;
 
-using SpellingPropertiesList = vector<const EdgeProperties*>;
-using SpellingIndex = map<SyllableId, SpellingPropertiesList>;
-using SpellingIndices = map<size_t, SpellingIndex>;
+using SpellingPropertiesList = arena_vector<const EdgeProperties*>;
+using SpellingIndex = arena_map<SyllableId, SpellingPropertiesList>;
+using SpellingIndices = arena_map<size_t, SpellingIndex>;
 
 struct SyllableGraph {
   size_t input_length = 0;
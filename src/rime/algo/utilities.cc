@@ -30,6 +30,15 @@ int CompareVersionString(const string& x, const string& y) {
   return 0;
 }
 
+uint64_t HashText(const string& text) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : text) {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
 ChecksumComputer::ChecksumComputer(uint32_t initial_remainder)
     : crc_(initial_remainder) {}
 
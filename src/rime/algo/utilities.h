@@ -9,6 +9,7 @@
 
 #include <stdint.h>
 #include <boost/crc.hpp>
+#include <rime_api.h>
 #include <rime/common.h>
 
 namespace rime {
@@ -16,6 +17,9 @@ namespace rime {
 int CompareVersionString(const string& x,
                          const string& y);
 
+// 64-bit FNV-1a hash of the text, for keys that need not keep the text.
+RIME_API uint64_t HashText(const string& text);
+
 class ChecksumComputer {
  public:
   explicit ChecksumComputer(uint32_t initial_remainder = 0);
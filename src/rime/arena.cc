@@ -0,0 +1,123 @@
+//
+// Copyright RIME Developers
+// Distributed under the BSD License
+//
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <rime/arena.h>
+
+namespace rime {
+
+const size_t Arena::kInitialBlockSize;
+const size_t Arena::kMaxBlockSize;
+
+static thread_local Arena* current_arena = nullptr;
+
+static std::atomic<unsigned long long> next_arena_id{1};
+
+// the chunk a thread other than the owner allocates from, in the arena
+// identified by arena_id.
+struct ForeignChunk {
+  unsigned long long arena_id = 0;
+  char* cursor = nullptr;
+  char* limit = nullptr;
+  size_t next_size = Arena::kInitialBlockSize;
+};
+
+static thread_local ForeignChunk foreign_chunk;
+
+static void* BumpAligned(char** cursor, char* limit,
+                         size_t size, size_t alignment) {
+  if (!*cursor)
+    return nullptr;
+  auto address = reinterpret_cast<uintptr_t>(*cursor);
+  size_t padding = (alignment - address % alignment) % alignment;
+  if (padding + size > static_cast<size_t>(limit - *cursor))
+    return nullptr;
+  void* ptr = *cursor + padding;
+  *cursor += padding + size;
+  return ptr;
+}
+
+Arena::Arena() : id_(next_arena_id++), owner_(std::this_thread::get_id()) {
+}
+
+Arena::~Arena() {
+  for (char* block : blocks_) {
+    delete[] block;
+  }
+  for (char* block : foreign_blocks_) {
+    delete[] block;
+  }
+}
+
+void* Arena::AllocateBlock(size_t size) {
+  char* block = new char[size];
+  blocks_.push_back(block);
+  return block;
+}
+
+void* Arena::AllocateForeign(size_t size, size_t alignment) {
+  ++num_foreign_allocations_;
+  auto& chunk = foreign_chunk;
+  if (chunk.arena_id == id_) {
+    if (void* ptr = BumpAligned(&chunk.cursor, chunk.limit, size, alignment))
+      return ptr;
+  } else {
+    chunk = ForeignChunk();
+    chunk.arena_id = id_;
+  }
+  bool own_block = size + alignment > kMaxBlockSize / 4;
+  size_t block_size = own_block ? size : chunk.next_size;
+  // new[] returns memory suitably aligned for any fundamental type.
+  char* block = new char[block_size];
+  {
+    std::lock_guard<std::mutex> lock(foreign_mutex_);
+    foreign_blocks_.push_back(block);
+  }
+  ++num_foreign_blocks_;
+  if (own_block)
+    return block;
+  chunk.next_size = (std::min)(chunk.next_size * 2, kMaxBlockSize);
+  chunk.cursor = block + size;
+  chunk.limit = block + block_size;
+  return block;
+}
+
+void* Arena::Allocate(size_t size, size_t alignment) {
+  if (std::this_thread::get_id() != owner_) {
+    return AllocateForeign(size, alignment);
+  }
+  ++num_allocations_;
+  bytes_allocated_ += size;
+  if (void* ptr = BumpAligned(&cursor_, limit_, size, alignment)) {
+    return ptr;
+  }
+  // large objects get a block of their own, leaving the current one intact.
+  if (size + alignment > kMaxBlockSize / 4) {
+    return AllocateBlock(size);
+  }
+  size_t block_size = next_block_size_;
+  next_block_size_ = (std::min)(next_block_size_ * 2, kMaxBlockSize);
+  // new[] returns memory suitably aligned for any fundamental type.
+  cursor_ = static_cast<char*>(AllocateBlock(block_size));
+  limit_ = cursor_ + block_size;
+  void* ptr = cursor_;
+  cursor_ += size;
+  return ptr;
+}
+
+Arena* Arena::current() {
+  return current_arena;
+}
+
+Arena::Scope::Scope(Arena* arena) : previous_(current_arena) {
+  current_arena = arena;
+}
+
+Arena::Scope::~Scope() {
+  current_arena = previous_;
+}
+
+}  // namespace rime
@@ -0,0 +1,158 @@
+//
+// Copyright RIME Developers
+// Distributed under the BSD License
+//
+#ifndef RIME_ARENA_H_
+#define RIME_ARENA_H_
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <rime_api.h>
+
+namespace rime {
+
+// A monotonic memory resource for the short-lived objects created while
+// translating a segment. Memory is never reused; it is released in bulk
+// once the arena and every object allocated from it are gone.
+//
+// Allocations on the thread that created the arena bump a pointer without
+// locking. Other threads may still allocate (e.g. containers copied by a
+// background worker): each of them is given chunks of its own to bump a
+// pointer in, and only takes a lock to obtain a new chunk.
+class Arena : public std::enable_shared_from_this<Arena> {
+ public:
+  static const size_t kInitialBlockSize = 4096;
+  static const size_t kMaxBlockSize = 64 * 1024;
+
+  RIME_API Arena();
+  Arena(const Arena&) = delete;
+  Arena& operator= (const Arena&) = delete;
+  RIME_API ~Arena();
+
+  RIME_API void* Allocate(size_t size, size_t alignment);
+
+  // number of objects served
+  size_t num_allocations() const {
+    return num_allocations_ + num_foreign_allocations_;
+  }
+  // number of memory blocks obtained from the system allocator
+  size_t num_blocks() const {
+    return blocks_.size() + num_foreign_blocks_;
+  }
+  size_t bytes_allocated() const { return bytes_allocated_; }
+  // number of objects allocated by threads other than the owner
+  size_t num_foreign_allocations() const { return num_foreign_allocations_; }
+
+  // the arena in effect on the calling thread, if any.
+  RIME_API static Arena* current();
+
+  // Makes an arena current on the calling thread for its lifetime.
+  class Scope {
+   public:
+    RIME_API explicit Scope(Arena* arena);
+    RIME_API ~Scope();
+    Scope(const Scope&) = delete;
+    Scope& operator= (const Scope&) = delete;
+
+   private:
+    Arena* previous_;
+  };
+
+ private:
+  void* AllocateBlock(size_t size);
+  void* AllocateForeign(size_t size, size_t alignment);
+
+  // tells the arenas apart in the chunks of other threads, since an arena
+  // may be allocated at the address of a previous one.
+  const unsigned long long id_;
+  const std::thread::id owner_;
+  std::vector<char*> blocks_;
+  char* cursor_ = nullptr;
+  char* limit_ = nullptr;
+  size_t next_block_size_ = kInitialBlockSize;
+  size_t num_allocations_ = 0;
+  size_t bytes_allocated_ = 0;
+
+  std::mutex foreign_mutex_;
+  std::vector<char*> foreign_blocks_;
+  std::atomic<size_t> num_foreign_allocations_{0};
+  std::atomic<size_t> num_foreign_blocks_{0};
+};
+
+// Allocates from the arena current at construction time, or from the heap
+// when there is none. Each copy shares ownership of the arena, so objects
+// allocated with it stay valid after the menu owning the arena is gone.
+template <class T>
+class ArenaAllocator {
+ public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  ArenaAllocator()
+      : arena_(Arena::current() ? Arena::current()->shared_from_this()
+                                : nullptr) {}
+  explicit ArenaAllocator(std::shared_ptr<Arena> arena)
+      : arena_(std::move(arena)) {}
+  template <class U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(
+        arena_ ? arena_->Allocate(n * sizeof(T), alignof(T))
+               : ::operator new(n * sizeof(T)));
+  }
+  void deallocate(T* p, size_t /*n*/) {
+    if (!arena_)
+      ::operator delete(p);
+  }
+
+  const std::shared_ptr<Arena>& arena() const { return arena_; }
+
+ private:
+  std::shared_ptr<Arena> arena_;
+};
+
+template <class T, class U>
+inline bool operator== (const ArenaAllocator<T>& a,
+                        const ArenaAllocator<U>& b) {
+  return a.arena() == b.arena();
+}
+
+template <class T, class U>
+inline bool operator!= (const ArenaAllocator<T>& a,
+                        const ArenaAllocator<U>& b) {
+  return !(a == b);
+}
+
+template <class Key, class T>
+using arena_map = std::map<Key, T, std::less<Key>,
+                           ArenaAllocator<std::pair<const Key, T>>>;
+template <class T>
+using arena_vector = std::vector<T, ArenaAllocator<T>>;
+
+// Objects of classes derived from ArenaObject are created by New<>() in the
+// arena current on the calling thread, if any.
+struct ArenaObject {};
+
+template <class T, class... Args>
+inline std::shared_ptr<T> NewInArena(Args&&... args) {
+  if (Arena* arena = Arena::current()) {
+    return std::allocate_shared<T>(
+        ArenaAllocator<T>(arena->shared_from_this()),
+        std::forward<Args>(args)...);
+  }
+  return std::make_shared<T>(std::forward<Args>(args)...);
+}
+
+}  // namespace rime
+
+#endif  // RIME_ARENA_H_
@@ -11,7 +11,7 @@
 
 namespace rime {
 
-class Candidate {
+class Candidate : public ArenaObject {
  public:
   Candidate() = default;
   Candidate(const string type,
@@ -21,6 +21,7 @@
 #include <utility>
 #include <vector>
 #include <boost/optional.hpp>
+#include <rime/arena.h>
 #define BOOST_BIND_NO_PLACEHOLDERS
 #ifdef RIME_BOOST_SIGNALS2
 #include <boost/signals2/connection.hpp>
@@ -77,10 +78,21 @@ inline bool Is(const an<Y>& ptr) {
 }
 
 template <class T, class... Args>
-inline an<T> New(Args&&... args) {
+inline an<T> NewObject(std::false_type /*arena_object*/, Args&&... args) {
   return std::make_shared<T>(std::forward<Args>(args)...);
 }
 
+template <class T, class... Args>
+inline an<T> NewObject(std::true_type /*arena_object*/, Args&&... args) {
+  return NewInArena<T>(std::forward<Args>(args)...);
+}
+
+template <class T, class... Args>
+inline an<T> New(Args&&... args) {
+  return NewObject<T>(std::is_base_of<ArenaObject, T>(),
+                      std::forward<Args>(args)...);
+}
+
 #ifdef RIME_BOOST_SIGNALS2
 using boost::signals2::connection;
 using boost::signals2::signal;
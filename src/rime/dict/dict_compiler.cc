@@ -118,7 +118,8 @@ bool DictCompiler::Compile(const string &schema_file) {
   const auto& primary_table = tables_[0];
   if (primary_table->Exists() && primary_table->Load()) {
     if (build_table_from_source) {
-      rebuild_table = primary_table->dict_file_checksum() != dict_file_checksum;
+      rebuild_table = primary_table->dict_file_checksum() != dict_file_checksum ||
+                      !primary_table->Verify();
     } else {
       dict_file_checksum = primary_table->dict_file_checksum();
       LOG(INFO) << "reuse existing table: " << primary_table->file_name();
@@ -133,7 +134,8 @@ bool DictCompiler::Compile(const string &schema_file) {
   }
   if (prism_->Exists() && prism_->Load()) {
     rebuild_prism = prism_->dict_file_checksum() != dict_file_checksum ||
-                    prism_->schema_file_checksum() != schema_file_checksum;
+                    prism_->schema_file_checksum() != schema_file_checksum ||
+                    !prism_->Verify();
     prism_->Close();
   } else {
     rebuild_prism = true;
@@ -265,11 +267,24 @@ bool DictCompiler::BuildTable(int table_index,
       vocabulary.SortHomophones();
     }
     table->Remove();
-    if (!table->Build(collector.syllabary,
-                      vocabulary,
-                      collector.num_entries,
-                      dict_file_checksum) ||
-        !table->Save()) {
+    bool success = false;
+    if (table_index == 0) {
+      success = table->Build(collector.syllabary,
+                             vocabulary,
+                             collector.num_entries,
+                             dict_file_checksum);
+    }
+    else {
+      // packs share the syllabary of the primary table
+      const auto& primary_table = tables_[0];
+      success = (primary_table->IsOpen() || primary_table->Load()) &&
+          table->BuildPack(primary_table,
+                           vocabulary,
+                           collector.num_entries,
+                           dict_file_checksum,
+                           settings->share_strings());
+    }
+    if (!success || !table->Save()) {
       return false;
     }
   }
@@ -321,6 +336,7 @@ bool DictCompiler::BuildPrism(const string &schema_file,
     return false;
  // apply spelling algebra and prepare corrections (if enabled)
   Script script;
+  int completion_depth = 0;
   if (!schema_file.empty()) {
     Config config;
     if (!config.LoadFromFile(schema_file)) {
@@ -337,6 +353,8 @@ bool DictCompiler::BuildPrism(const string &schema_file,
         script.clear();
       }
     }
+    // precompute completions of short prefixes (0 to disable)
+    config.GetInt("speller/prism_completion_depth", &completion_depth);
 
 #if 0
     // build corrector
@@ -369,7 +387,8 @@ bool DictCompiler::BuildPrism(const string &schema_file,
   {
     prism_->Remove();
     if (!prism_->Build(syllabary, script.empty() ? nullptr : &script,
-                       dict_file_checksum, schema_file_checksum) ||
+                       dict_file_checksum, schema_file_checksum,
+                       (std::max)(completion_depth, 0)) ||
         !prism_->Save()) {
       return false;
     }
@@ -69,6 +69,10 @@ bool DictSettings::use_rule_based_encoder() {
   return (*this)["encoder"]["rules"].IsList();
 }
 
+bool DictSettings::share_strings() {
+  return (*this)["share_strings"].ToBool();
+}
+
 int DictSettings::max_phrase_length() {
   return (*this)["max_phrase_length"].ToInt();
 }
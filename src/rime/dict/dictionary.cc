@@ -4,6 +4,7 @@
 //
 // 2011-07-05 GONG Chen <chen.sst@gmail.com>
 //
+#include <algorithm>
 #include <boost/filesystem.hpp>
 #include <rime/algo/syllabifier.h>
 #include <rime/common.h>
@@ -26,10 +27,14 @@ struct Chunk {
   size_t cursor = 0;
   string remaining_code;  // for predictive queries
   double credibility = 0.0;
+  // shared by all entries of the chunk
+  SyllablePath path;
 
   Chunk() = default;
-  Chunk(Table* t, const Code& c, const table::Entry* e, double cr = 0.0)
-      : table(t), code(c), entries(e), size(1), cursor(0), credibility(cr) {}
+  Chunk(Table* t, const Code& c, const table::Entry* e, double cr = 0.0,
+        SyllablePath p = SyllablePath())
+      : table(t), code(c), entries(e), size(1), cursor(0), credibility(cr),
+        path(std::move(p)) {}
   Chunk(Table* t, const TableAccessor& a, double cr = 0.0)
       : Chunk(t, a, string(), cr) {}
   Chunk(Table* t, const TableAccessor& a, const string& r, double cr = 0.0)
@@ -39,19 +44,78 @@ struct Chunk {
 
 struct QueryResult {
   vector<Chunk> chunks;
+  // positions of the chunks to take the next entries from, in merged order
+  vector<size_t> run;
+  size_t run_cursor = 0;
+  // scratch space for merging
+  vector<double> scores;
 };
 
-bool compare_chunk_by_head_element(const Chunk& a, const Chunk& b) {
-  if (!a.entries || a.cursor >= a.size) return false;
-  if (!b.entries || b.cursor >= b.size) return true;
-  if (a.remaining_code.length() != b.remaining_code.length())
-    return a.remaining_code.length() < b.remaining_code.length();
-  return a.credibility + a.entries[a.cursor].weight >
-         b.credibility + b.entries[b.cursor].weight;  // by weight desc
+// number of entries merged at a time
+const size_t kMergeBlockSize = 32;
+
+// Scores up to kMergeBlockSize upcoming entries of every chunk in bulk, then
+// merges them into the next run. Entries are ordered by remaining code length
+// and then by weight desc, as if chunks were compared by their head elements
+// one entry at a time.
+void merge_next_block(QueryResult* result) {
+  const auto& chunks = result->chunks;
+  auto& scores = result->scores;
+  result->run.clear();
+  result->run_cursor = 0;
+  scores.clear();
+  struct Head {
+    size_t chunk;
+    size_t score;
+    size_t end;
+  };
+  vector<Head> heads;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    const auto& chunk = chunks[i];
+    if (!chunk.entries || chunk.cursor >= chunk.size)
+      continue;
+    size_t n = (std::min)(kMergeBlockSize, chunk.size - chunk.cursor);
+    size_t offset = scores.size();
+    scores.resize(offset + n);
+    double* s = &scores[offset];
+    const table::Entry* e = &chunk.entries[chunk.cursor];
+    for (size_t j = 0; j < n; ++j)
+      s[j] = e[j].weight;
+    // a separate pass over contiguous scores, which the compiler vectorizes
+    const double credibility = chunk.credibility;
+    for (size_t j = 0; j < n; ++j)
+      s[j] += credibility;
+    heads.push_back({i, offset, offset + n});
+  }
+  // a chunk can run out of scored entries only at the end of the run,
+  // after having been taken kMergeBlockSize times.
+  auto after = [&](const Head& a, const Head& b) {
+    size_t a_length = chunks[a.chunk].remaining_code.length();
+    size_t b_length = chunks[b.chunk].remaining_code.length();
+    if (a_length != b_length)
+      return a_length > b_length;
+    if (scores[a.score] != scores[b.score])
+      return scores[a.score] < scores[b.score];
+    return a.chunk > b.chunk;
+  };
+  std::make_heap(heads.begin(), heads.end(), after);
+  while (!heads.empty() && result->run.size() < kMergeBlockSize) {
+    std::pop_heap(heads.begin(), heads.end(), after);
+    Head& head = heads.back();
+    result->run.push_back(head.chunk);
+    if (++head.score < head.end) {
+      std::push_heap(heads.begin(), heads.end(), after);
+    }
+    else {
+      heads.pop_back();
+    }
+  }
 }
 
+// Appends to path the syllables of the best match.
 size_t match_extra_code(const table::Code* extra_code, size_t depth,
-                        const SyllableGraph& syll_graph, size_t current_pos) {
+                        const SyllableGraph& syll_graph, size_t current_pos,
+                        SyllablePath* path) {
   if (!extra_code || depth >= extra_code->size)
     return current_pos;  // success
   if (current_pos >= syll_graph.interpreted_length)
@@ -64,34 +128,150 @@ size_t match_extra_code(const table::Code* extra_code, size_t depth,
   if (spellings == index->second.end())
     return 0;
   size_t best_match = 0;
-  for (const SpellingProperties* props : spellings->second) {
+  const size_t path_size = path->size();
+  SyllablePath best_path;
+  for (const EdgeProperties* props : spellings->second) {
+    path->resize(path_size);
+    path->push_back({static_cast<uint32_t>(props->end_pos),
+                     props->is_correction});
     size_t match_end_pos = match_extra_code(extra_code, depth + 1,
-                                            syll_graph, props->end_pos);
+                                            syll_graph, props->end_pos, path);
     if (!match_end_pos) continue;
-    if (match_end_pos > best_match)
+    if (match_end_pos > best_match) {
       best_match = match_end_pos;
+      best_path.assign(path->begin() + path_size, path->end());
+    }
   }
+  path->resize(path_size);
+  path->insert(path->end(), best_path.begin(), best_path.end());
   return best_match;
 }
 
+struct compare_extra_code_at {
+  size_t depth;
+  bool operator() (const table::LongEntry& a, SyllableId b) const {
+    return a.extra_code.at[depth] < b;
+  }
+  bool operator() (SyllableId a, const table::LongEntry& b) const {
+    return a < b.extra_code.at[depth];
+  }
+};
+
+// narrows down [first, last), which share the first `depth` syllables of
+// extra code, by the syllables found in the graph at `current_pos`,
+// appending every complete match on the way.
+static void collect_sorted_tail(const table::LongEntry* base,
+                                const table::LongEntry* first,
+                                const table::LongEntry* last,
+                                size_t depth,
+                                const SyllableGraph& syll_graph,
+                                size_t current_pos,
+                                SyllablePath* path,
+                                vector<TailMatch>* matches) {
+  // shorter codes come first
+  for (; first != last && first->extra_code.size == depth; ++first) {
+    if (current_pos > 0) {
+      matches->push_back(
+          {static_cast<size_t>(first - base), current_pos, *path});
+    }
+  }
+  if (first == last || current_pos >= syll_graph.interpreted_length)
+    return;
+  auto index = syll_graph.indices.find(current_pos);
+  if (index == syll_graph.indices.end())
+    return;
+  for (const auto& spellings : index->second) {
+    auto range = std::equal_range(first, last, spellings.first,
+                                  compare_extra_code_at{depth});
+    if (range.first == range.second)
+      continue;
+    for (const EdgeProperties* props : spellings.second) {
+      path->push_back({static_cast<uint32_t>(props->end_pos),
+                       props->is_correction});
+      collect_sorted_tail(base, range.first, range.second, depth + 1,
+                          syll_graph, props->end_pos, path, matches);
+      path->pop_back();
+    }
+  }
+}
+
+void match_sorted_tail(const table::LongEntry* entries,
+                       size_t num_entries,
+                       const SyllableGraph& syll_graph,
+                       size_t start_pos,
+                       const SyllablePath& index_path,
+                       vector<TailMatch>* matches) {
+  const size_t num_matches_before = matches->size();
+  SyllablePath path(index_path);
+  collect_sorted_tail(entries, entries, entries + num_entries, 0,
+                      syll_graph, start_pos, &path, matches);
+  // an entry may be matched along several paths; keep the first of those
+  // reaching furthest, as match_extra_code() does.
+  auto begin = matches->begin() + num_matches_before;
+  std::stable_sort(begin, matches->end(),
+                   [](const TailMatch& a, const TailMatch& b) {
+                     return a.index < b.index;
+                   });
+  auto out = begin;
+  for (auto it = begin; it != matches->end(); ) {
+    auto best = it;
+    auto next = it + 1;
+    for (; next != matches->end() && next->index == it->index; ++next) {
+      if (next->end_pos > best->end_pos)
+        best = next;
+    }
+    if (out != best)
+      *out = std::move(*best);
+    ++out;
+    it = next;
+  }
+  matches->erase(out, matches->end());
+}
+
 }  // namespace dictionary
 
 DictEntryIterator::DictEntryIterator()
     : query_result_(New<dictionary::QueryResult>()) {}
 
+DictEntryIterator::DictEntryIterator(const DictEntryIterator& other)
+    : DictEntryFilterBinder(other),
+      query_result_(New<dictionary::QueryResult>(*other.query_result_)),
+      chunk_index_(other.chunk_index_),
+      entry_count_(other.entry_count_) {}
+
+DictEntryIterator& DictEntryIterator::operator= (
+    const DictEntryIterator& other) {
+  if (this != &other) {
+    DictEntryFilterBinder::operator=(other);
+    query_result_ = New<dictionary::QueryResult>(*other.query_result_);
+    chunk_index_ = other.chunk_index_;
+    // the temporary entry is created again on Peek()
+    entry_.reset();
+    entry_count_ = other.entry_count_;
+  }
+  return *this;
+}
+
 void DictEntryIterator::AddChunk(dictionary::Chunk&& chunk) {
-  query_result_->chunks.push_back(std::move(chunk));
   entry_count_ += chunk.size;
+  query_result_->chunks.push_back(std::move(chunk));
+  query_result_->run.clear();
 }
 
 void DictEntryIterator::Sort() {
-  auto& chunks = query_result_->chunks;
-  // partial-sort remaining chunks, move best match to chunk_index_
-  std::partial_sort(
-      chunks.begin() + chunk_index_,
-      chunks.begin() + chunk_index_ + 1,
-      chunks.end(),
-      dictionary::compare_chunk_by_head_element);
+  // merge again from the current state of all chunks
+  query_result_->run.clear();
+  query_result_->run_cursor = 0;
+  TakeNextChunk();
+}
+
+void DictEntryIterator::TakeNextChunk() {
+  auto& result = *query_result_;
+  if (result.run_cursor >= result.run.size()) {
+    dictionary::merge_next_block(&result);
+  }
+  chunk_index_ = result.run_cursor < result.run.size() ?
+      result.run[result.run_cursor++] : result.chunks.size();
 }
 
 void DictEntryIterator::AddFilter(DictEntryFilter filter) {
@@ -112,6 +292,7 @@ an<DictEntry> DictEntryIterator::Peek() {
                << chunk.table->GetEntryText(e) << "'.";
     entry_ = New<DictEntry>();
     entry_->code = chunk.code;
+    entry_->path = chunk.path;
     entry_->text = chunk.table->GetEntryText(e);
     const double kS = 18.420680743952367; // log(1e8)
     entry_->weight = e.weight - kS + chunk.credibility;
@@ -127,17 +308,9 @@ bool DictEntryIterator::FindNextEntry() {
   if (exhausted()) {
     return false;
   }
-  auto& chunk = query_result_->chunks[chunk_index_];
-  if (++chunk.cursor >= chunk.size) {
-    ++chunk_index_;
-  }
-  // reorder chunks since the current chunk has got a new head element
-  if (exhausted()) {
-    return false;
-  } else {
-    Sort();
-    return true;
-  }
+  ++query_result_->chunks[chunk_index_].cursor;
+  TakeNextChunk();
+  return !exhausted();
 }
 
 bool DictEntryIterator::Next() {
@@ -155,15 +328,8 @@ bool DictEntryIterator::Next() {
 
 // Note: does not apply filters
 bool DictEntryIterator::Skip(size_t num_entries) {
-  while (num_entries > 0) {
-    if (exhausted()) return false;
-    auto& chunk = query_result_->chunks[chunk_index_];
-    if (chunk.cursor + num_entries < chunk.size) {
-      chunk.cursor += num_entries;
-      return true;
-    }
-    num_entries -= (chunk.size - chunk.cursor);
-    ++chunk_index_;
+  for (; num_entries > 0; --num_entries) {
+    if (!FindNextEntry()) return false;
   }
   return true;
 }
@@ -193,27 +359,48 @@ static void lookup_table(Table* table,
                          const SyllableGraph& syllable_graph,
                          size_t start_pos,
                          double initial_credibility) {
-  TableQueryResult result;
+  // reused by lookups on the same thread
+  static thread_local TableQueryResult result;
   if (!table->Query(syllable_graph, start_pos, &result)) {
     return;
   }
   // copy result
-  for (auto& v : result) {
-    size_t end_pos = v.first;
-    for (TableAccessor& a : v.second) {
+  for (size_t end_pos = 0; end_pos < result.end_pos_limit(); ++end_pos) {
+    for (TableAccessor& a : result.at(end_pos)) {
       double cr = initial_credibility + a.credibility();
-      if (a.extra_code()) {
+      SyllablePath path(a.path(), a.path() + a.index_code().size());
+      if (a.extra_code() && table->sorted_tail()) {
+        // reused by lookups on the same thread
+        static thread_local vector<dictionary::TailMatch> matches;
+        matches.clear();
+        const table::LongEntry* entries = a.long_entries();
+        dictionary::match_sorted_tail(entries, a.remaining(), syllable_graph,
+                                      end_pos, path, &matches);
+        for (auto& match : matches) {
+          Code code(a.index_code());
+          const auto& extra_code(entries[match.index].extra_code);
+          code.insert(code.end(), extra_code.begin(), extra_code.end());
+          (*collector)[match.end_pos].AddChunk(
+              {table, code, &entries[match.index].entry, cr,
+               std::move(match.path)});
+        }
+      }
+      else if (a.extra_code()) {
+        const size_t index_path_size = path.size();
         do {
+          path.resize(index_path_size);
           size_t actual_end_pos = dictionary::match_extra_code(
-              a.extra_code(), 0, syllable_graph, end_pos);
+              a.extra_code(), 0, syllable_graph, end_pos, &path);
           if (actual_end_pos == 0) continue;
           (*collector)[actual_end_pos].AddChunk(
-              {table, a.code(), a.entry(), cr});
+              {table, a.code(), a.entry(), cr, path});
         }
         while (a.Next());
       }
       else {
-        (*collector)[end_pos].AddChunk({table, a, cr});
+        dictionary::Chunk chunk(table, a, cr);
+        chunk.path = std::move(path);
+        (*collector)[end_pos].AddChunk(std::move(chunk));
       }
     }
   }
@@ -241,6 +428,36 @@ Dictionary::Lookup(const SyllableGraph& syllable_graph,
   return collector;
 }
 
+void Dictionary::LookupAll(const SyllableGraph& syllable_graph,
+                           map<size_t, an<DictEntryCollector>>* results,
+                           double initial_credibility) {
+  if (!loaded())
+    return;
+  map<size_t, an<DictEntryCollector>> collectors;
+  for (const auto& x : syllable_graph.edges) {
+    if (results->find(x.first) == results->end())
+      collectors[x.first] = New<DictEntryCollector>();
+  }
+  // visit all start positions while the table is warm
+  for (const auto& table : tables_) {
+    if (!table->IsOpen())
+      continue;
+    for (auto& c : collectors) {
+      lookup_table(table.get(), c.second.get(),
+                   syllable_graph, c.first, initial_credibility);
+    }
+  }
+  for (auto& c : collectors) {
+    auto& collector = (*results)[c.first];
+    if (c.second->empty())
+      continue;
+    for (auto& v : *c.second) {
+      v.second.Sort();
+    }
+    collector = std::move(c.second);
+  }
+}
+
 size_t Dictionary::LookupWords(DictEntryIterator* result,
                                const string& str_code,
                                bool predictive,
@@ -334,7 +551,10 @@ bool Dictionary::Load() {
   // packs are optional
   for (int i = 1; i < tables_.size(); ++i) {
     const auto& table = tables_[i];
-    if (!table->IsOpen() && table->Exists() && table->Load()) {
+    if (table->IsOpen())
+      continue;
+    table->set_primary_table(primary_table);
+    if (table->Exists() && table->Load()) {
       LOG(INFO) << "loaded pack: " << packs_[i - 1];
     }
   }
@@ -391,9 +611,32 @@ Dictionary* DictionaryComponent::Create(const Ticket& ticket) {
       }
     }
   }
-  return Create(std::move(dict_name),
-                std::move(prism_name),
-                std::move(packs));
+  auto dict = Create(std::move(dict_name),
+                     std::move(prism_name),
+                     std::move(packs));
+  int string_cache_size = 0;
+  if (config->GetInt(ticket.name_space + "/string_cache_size",
+                     &string_cache_size) && string_cache_size > 0) {
+    for (const auto& table : dict->tables()) {
+      table->set_string_cache_size(string_cache_size);
+    }
+  }
+  const string policy_path = ticket.name_space + "/mapping_policy";
+  if (config->GetMap(policy_path)) {
+    MappingPolicy policy;
+    config->GetBool(policy_path + "/random_access", &policy.random_access);
+    config->GetBool(policy_path + "/prefetch", &policy.prefetch);
+    config->GetBool(policy_path + "/huge_pages", &policy.huge_pages);
+    for (const auto& table : dict->tables()) {
+      table->merge_mapping_policy(policy);
+    }
+    // the prism is small and touched on every keystroke
+    config->GetBool(policy_path + "/lock_prism", &policy.lock);
+    if (dict->prism()) {
+      dict->prism()->merge_mapping_policy(policy);
+    }
+  }
+  return dict;
 }
 
 Dictionary* DictionaryComponent::Create(string dict_name,
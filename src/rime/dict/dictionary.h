@@ -16,19 +16,49 @@
 
 namespace rime {
 
+struct SyllableGraph;
+
 namespace dictionary {
 
 struct Chunk;
 struct QueryResult;
 
+// the best match of a tail entry in the syllable graph.
+struct TailMatch {
+  // of the entry among those given
+  size_t index;
+  size_t end_pos;
+  SyllablePath path;
+};
+
+// Appends to path the syllables of the best match of the extra code from
+// `depth` on, returning its end position, or 0 if there is no match.
+RIME_API size_t match_extra_code(const table::Code* extra_code,
+                                 size_t depth,
+                                 const SyllableGraph& syll_graph,
+                                 size_t current_pos,
+                                 SyllablePath* path);
+
+// For tail entries sorted by extra code: finds the same matches as
+// match_extra_code() does for each entry, by narrowing down the entries
+// syllable by syllable. Appends the matches in entry order.
+RIME_API void match_sorted_tail(const table::LongEntry* entries,
+                                size_t num_entries,
+                                const SyllableGraph& syll_graph,
+                                size_t start_pos,
+                                const SyllablePath& index_path,
+                                vector<TailMatch>* matches);
+
 }  // namespace dictionary
 
 class DictEntryIterator : public DictEntryFilterBinder {
  public:
   RIME_API DictEntryIterator();
   virtual ~DictEntryIterator() = default;
-  DictEntryIterator(const DictEntryIterator& other) = default;
-  DictEntryIterator& operator= (const DictEntryIterator& other) = default;
+  // copies take a snapshot of the query state, so that iterating a copy
+  // does not advance the original.
+  RIME_API DictEntryIterator(const DictEntryIterator& other);
+  RIME_API DictEntryIterator& operator= (const DictEntryIterator& other);
   DictEntryIterator(DictEntryIterator&& other) = default;
   DictEntryIterator& operator= (DictEntryIterator&& other) = default;
 
@@ -43,6 +73,8 @@ class DictEntryIterator : public DictEntryFilterBinder {
 
  protected:
   bool FindNextEntry();
+  // moves on to the chunk providing the next entry in merged order.
+  void TakeNextChunk();
 
  private:
   an<dictionary::QueryResult> query_result_;
@@ -56,7 +88,6 @@ using DictEntryCollector = map<size_t, DictEntryIterator>;
 class Config;
 class Schema;
 class EditDistanceCorrector;
-struct SyllableGraph;
 struct Ticket;
 
 class Dictionary : public Class<Dictionary, const Ticket&> {
@@ -74,6 +105,12 @@ class Dictionary : public Class<Dictionary, const Ticket&> {
   RIME_API an<DictEntryCollector> Lookup(const SyllableGraph& syllable_graph,
                                          size_t start_pos,
                                          double initial_credibility = 0.0);
+  // looks up phrases from every start position of the syllable graph in a
+  // single pass over each table. start positions already present in results
+  // are taken as looked up, so that a previous result can be reused.
+  RIME_API void LookupAll(const SyllableGraph& syllable_graph,
+                          map<size_t, an<DictEntryCollector>>* results,
+                          double initial_credibility = 0.0);
   // if predictive is true, do an expand search with limit,
   // otherwise do an exact match.
   // return num of matching keys.
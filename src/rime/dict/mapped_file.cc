@@ -7,6 +7,7 @@
 // 2011-06-30 GONG Chen <chen.sst@gmail.com>
 //
 #include <fstream>
+#include <boost/crc.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/interprocess/file_mapping.hpp>
 #include <boost/interprocess/mapped_region.hpp>
@@ -38,6 +39,12 @@ static BOOL resize_file_api(const char* p, boost::uintmax_t size) {
 
 #endif  // BOOST_RESIZE_FILE
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#define RIME_HAS_MADVISE
+#endif  // _WIN32
+
 namespace rime {
 
 class MappedFileImpl {
@@ -55,6 +62,10 @@ class MappedFileImpl {
     region_.reset(new boost::interprocess::mapped_region(*file_, file_mapping_mode));
   }
   ~MappedFileImpl() {
+#ifdef RIME_HAS_MADVISE
+    if (locked_)
+      ::munlock(get_address(), get_size());
+#endif  // RIME_HAS_MADVISE
     region_.reset();
     file_.reset();
   }
@@ -67,11 +78,44 @@ class MappedFileImpl {
   size_t get_size() const {
     return region_->get_size();
   }
+#ifdef RIME_HAS_MADVISE
+  bool Advise(const void* address, size_t length, int advice) {
+    // madvise() requires a page-aligned address
+    uintptr_t page_size = static_cast<uintptr_t>(::sysconf(_SC_PAGESIZE));
+    uintptr_t begin = reinterpret_cast<uintptr_t>(address);
+    uintptr_t end = begin + length;
+    begin &= ~(page_size - 1);
+    return ::madvise(reinterpret_cast<void*>(begin), end - begin, advice) == 0;
+  }
+  bool Lock() {
+    locked_ = ::mlock(get_address(), get_size()) == 0;
+    return locked_;
+  }
+#endif  // RIME_HAS_MADVISE
+  void ApplyPolicy(const MappingPolicy& policy) {
+#ifdef RIME_HAS_MADVISE
+    if (policy.random_access && !Advise(get_address(), get_size(), MADV_RANDOM))
+      LOG(WARNING) << "madvise(MADV_RANDOM) failed.";
+#ifdef MADV_HUGEPAGE
+    if (policy.huge_pages && !Advise(get_address(), get_size(), MADV_HUGEPAGE))
+      LOG(WARNING) << "madvise(MADV_HUGEPAGE) failed.";
+#endif  // MADV_HUGEPAGE
+    if (policy.lock && !Lock())
+      LOG(WARNING) << "mlock failed; the file is mapped without locking.";
+#endif  // RIME_HAS_MADVISE
+  }
+  bool Prefetch(const void* address, size_t length) {
+#ifdef RIME_HAS_MADVISE
+    return Advise(address, length, MADV_WILLNEED);
+#else
+    return false;
+#endif  // RIME_HAS_MADVISE
+  }
 
  private:
   the<boost::interprocess::file_mapping> file_;
   the<boost::interprocess::mapped_region> region_;
-
+  bool locked_ = false;
 };
 
 MappedFile::MappedFile(const string& file_name)
@@ -114,6 +158,7 @@ bool MappedFile::OpenReadOnly() {
   }
   file_.reset(new MappedFileImpl(file_name_, MappedFileImpl::kOpenReadOnly));
   size_ = file_->get_size();
+  file_->ApplyPolicy(policy_);
   return bool(file_);
 }
 
@@ -142,6 +187,66 @@ bool MappedFile::IsOpen() const {
   return bool(file_);
 }
 
+bool MappedFile::Prefetch(const void* address, size_t length) {
+  if (!file_ || !policy_.prefetch || !address)
+    return false;
+  return file_->Prefetch(address, length);
+}
+
+static uint32_t section_checksum(const char* data, size_t size) {
+  boost::crc_32_type crc;
+  crc.process_bytes(data, size);
+  return crc.checksum();
+}
+
+SectionDirectory* MappedFile::CreateSectionDirectory(
+    const vector<SectionSpan>& spans) {
+  auto directory = CreateArray<Section>(spans.size());
+  if (!directory)
+    return NULL;
+  for (size_t i = 0; i < spans.size(); ++i) {
+    const auto& span = spans[i];
+    auto& section = directory->at[i];
+    section.type = span.type;
+    section.flags = 0;
+    section.data = address() + span.begin;
+    section.size = span.end - span.begin;
+    section.checksum = section_checksum(section.data.get(), section.size);
+  }
+  return directory;
+}
+
+bool MappedFile::VerifySections(const SectionDirectory* directory) {
+  if (!directory)
+    return true;
+  for (const auto& section : *directory) {
+    const char* data = section.data.get();
+    if (!data || data < address() ||
+        data + section.size > address() + capacity()) {
+      LOG(ERROR) << "section " << section.type << " out of bounds in file '"
+                 << file_name_ << "'.";
+      return false;
+    }
+    if (section_checksum(data, section.size) != section.checksum) {
+      LOG(ERROR) << "checksum mismatch in section " << section.type
+                 << " of file '" << file_name_ << "'.";
+      return false;
+    }
+  }
+  return true;
+}
+
+const Section* MappedFile::FindSection(const SectionDirectory* directory,
+                                       uint32_t type) {
+  if (!directory)
+    return NULL;
+  for (const auto& section : *directory) {
+    if (section.type == type)
+      return &section;
+  }
+  return NULL;
+}
+
 bool MappedFile::Flush() {
   if (!file_)
     return false;
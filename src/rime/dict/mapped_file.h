@@ -83,8 +83,49 @@ struct List {
   const T* end() const { return &at[0] + size; }
 };
 
+// Sections are typed regions of a file, listed in a directory so that
+// new indices can be added to a format without breaking older readers,
+// which skip the types they do not know.
+
+constexpr uint32_t SectionType(char a, char b, char c, char d) {
+  return uint32_t(uint8_t(a)) | uint32_t(uint8_t(b)) << 8 |
+         uint32_t(uint8_t(c)) << 16 | uint32_t(uint8_t(d)) << 24;
+}
+
+struct Section {
+  uint32_t type;
+  // encoding of the data; 0 for raw bytes, the only encoding so far
+  uint32_t flags;
+  OffsetPtr<char> data;
+  uint32_t size;
+  // CRC-32 of the data
+  uint32_t checksum;
+};
+
+using SectionDirectory = Array<Section>;
+
+// a region of the file being built, as offsets from the beginning
+struct SectionSpan {
+  uint32_t type;
+  size_t begin;
+  size_t end;
+};
+
 // MappedFile class definition
 
+// Hints on how a read-only mapping is going to be accessed.
+// They are applied where the platform supports them and ignored elsewhere.
+struct MappingPolicy {
+  // pages are accessed in random order; disables read-ahead
+  bool random_access = false;
+  // read ahead the hot regions of the file, such as the head index
+  bool prefetch = false;
+  // back the mapping with transparent huge pages
+  bool huge_pages = false;
+  // keep the whole file resident in memory
+  bool lock = false;
+};
+
 class MappedFileImpl;
 
 class MappedFile : boost::noncopyable {
@@ -101,6 +142,10 @@ class MappedFile : boost::noncopyable {
 
   template <class T>
   T* Allocate(size_t count = 1);
+  // for space about to be overwritten in full; the pages are not touched
+  // until then.
+  template <class T>
+  T* AllocateUninitialized(size_t count);
 
   template <class T>
   Array<T>* CreateArray(size_t array_size);
@@ -108,9 +153,18 @@ class MappedFile : boost::noncopyable {
   String* CreateString(const string& str);
   bool CopyString(const string& src, String* dest);
 
+  // to be called once the data in all the spans is final.
+  SectionDirectory* CreateSectionDirectory(const vector<SectionSpan>& spans);
+  bool VerifySections(const SectionDirectory* directory);
+  static const Section* FindSection(const SectionDirectory* directory,
+                                    uint32_t type);
+
   size_t capacity() const;
   char* address() const;
 
+  // reads ahead a hot region of the file if the policy asks for it.
+  bool Prefetch(const void* address, size_t length);
+
  public:
   bool Exists() const;
   bool IsOpen() const;
@@ -123,9 +177,22 @@ class MappedFile : boost::noncopyable {
   const string& file_name() const { return file_name_; }
   size_t file_size() const { return size_; }
 
+  // takes effect the next time the file is opened read-only.
+  void set_mapping_policy(const MappingPolicy& policy) { policy_ = policy; }
+  // for files shared by several schemas: keeps every hint any of them
+  // requests, whatever the order they are loaded in.
+  void merge_mapping_policy(const MappingPolicy& policy) {
+    policy_.random_access |= policy.random_access;
+    policy_.prefetch |= policy.prefetch;
+    policy_.huge_pages |= policy.huge_pages;
+    policy_.lock |= policy.lock;
+  }
+  const MappingPolicy& mapping_policy() const { return policy_; }
+
  private:
   string file_name_;
   size_t size_ = 0;
+  MappingPolicy policy_;
   the<MappedFileImpl> file_;
 };
 
@@ -135,6 +202,15 @@ class MappedFile : boost::noncopyable {
 
 template <class T>
 T* MappedFile::Allocate(size_t count) {
+  T* ptr = AllocateUninitialized<T>(count);
+  if (ptr) {
+    std::memset(ptr, 0, sizeof(T) * count);
+  }
+  return ptr;
+}
+
+template <class T>
+T* MappedFile::AllocateUninitialized(size_t count) {
   if (!IsOpen())
     return NULL;
 
@@ -148,7 +224,6 @@ T* MappedFile::Allocate(size_t count) {
       return NULL;
   }
   T* ptr = reinterpret_cast<T*>(address() + used_space);
-  std::memset(ptr, 0, required_space);
   size_ = used_space + required_space;
   return ptr;
 }
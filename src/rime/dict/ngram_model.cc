@@ -0,0 +1,237 @@
+//
+// Copyright RIME Developers
+// Distributed under the BSD License
+//
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utf8.h>
+#include <rime/dict/ngram_model.h>
+
+namespace rime {
+
+const char kNgramModelFormat[] = "Rime::NgramModel/1.0";
+
+const char kNgramModelFormatPrefix[] = "Rime::NgramModel/";
+const size_t kNgramModelFormatPrefixLen = sizeof(kNgramModelFormatPrefix) - 1;
+
+// scores are quantized to this many levels below zero
+const int kMaxScoreLevel = 255;
+
+const char NgramModel::kContextDelimiter;
+const size_t NgramModel::kMaxContextLength;
+
+NgramModel::NgramModel(const string& file_name)
+    : MappedFile(file_name), trie_(new Darts::DoubleArray) {
+}
+
+bool NgramModel::Load() {
+  LOG(INFO) << "loading n-gram model: " << file_name();
+
+  if (IsOpen())
+    Close();
+
+  if (!OpenReadOnly()) {
+    LOG(ERROR) << "error opening n-gram model '" << file_name() << "'.";
+    return false;
+  }
+
+  metadata_ = Find<ngram::Metadata>(0);
+  if (!metadata_) {
+    LOG(ERROR) << "metadata not found.";
+    Close();
+    return false;
+  }
+  if (strncmp(metadata_->format,
+              kNgramModelFormatPrefix, kNgramModelFormatPrefixLen)) {
+    LOG(ERROR) << "invalid metadata.";
+    Close();
+    return false;
+  }
+  char* array = metadata_->double_array.get();
+  if (!array) {
+    LOG(ERROR) << "double array image not found.";
+    Close();
+    return false;
+  }
+  trie_->set_array(array, metadata_->double_array_size);
+  Prefetch(array, trie_->total_size());
+  sections_ = metadata_->sections.get();
+  return true;
+}
+
+bool NgramModel::Save() {
+  LOG(INFO) << "saving n-gram model: " << file_name();
+  if (!trie_->total_size()) {
+    LOG(ERROR) << "the trie has not been constructed!";
+    return false;
+  }
+  return ShrinkToFit() && Load();
+}
+
+static string join(vector<string>::const_iterator begin,
+                   vector<string>::const_iterator end,
+                   const string& delimiter) {
+  string result;
+  for (auto it = begin; it != end; ++it) {
+    if (it != begin)
+      result += delimiter;
+    result += *it;
+  }
+  return result;
+}
+
+bool NgramModel::Build(const vector<ngram::Count>& counts) {
+  // occurrences of each context, keyed by words joined with spaces
+  map<string, double> context_counts;
+  map<string, double> following_counts;
+  for (const auto& x : counts) {
+    if (x.words.empty() || x.count <= 0)
+      continue;
+    context_counts[join(x.words.begin(), x.words.end(), " ")] += x.count;
+    if (x.words.size() > 1) {
+      following_counts[join(x.words.begin(), x.words.end() - 1, " ")] +=
+          x.count;
+    }
+  }
+  // sorted as required by the double-array trie
+  map<string, double> scores;
+  size_t max_context_length = 0;
+  for (const auto& x : counts) {
+    if (x.words.size() < 2 || x.count <= 0 || x.words.back().empty())
+      continue;
+    string context = join(x.words.begin(), x.words.end() - 1, "");
+    size_t context_length =
+        utf8::unchecked::distance(context.c_str(),
+                                  context.c_str() + context.length());
+    if (context_length == 0 || context_length > kMaxContextLength)
+      continue;
+    const string prefix = join(x.words.begin(), x.words.end() - 1, " ");
+    auto found = context_counts.find(prefix);
+    double total = found != context_counts.end() ?
+        found->second : following_counts[prefix];
+    double score = (std::min)(0.0, std::log(x.count / total));
+    string key = context + kContextDelimiter + x.words.back();
+    // contexts of different words may end up the same text
+    auto inserted = scores.emplace(key, score);
+    if (!inserted.second && inserted.first->second < score) {
+      inserted.first->second = score;
+    }
+    max_context_length = (std::max)(max_context_length, context_length);
+  }
+  double max_cost = 0.0;
+  for (const auto& x : scores) {
+    max_cost = (std::max)(max_cost, -x.second);
+  }
+  const double score_step = max_cost > 0 ? max_cost / kMaxScoreLevel : 1.0;
+  size_t num_ngrams = scores.size();
+  vector<const char*> keys;
+  vector<size_t> lengths;
+  vector<int> values;
+  keys.reserve(num_ngrams);
+  lengths.reserve(num_ngrams);
+  values.reserve(num_ngrams);
+  for (const auto& x : scores) {
+    keys.push_back(x.first.c_str());
+    lengths.push_back(x.first.length());
+    values.push_back(static_cast<int>(std::lround(-x.second / score_step)));
+  }
+  const size_t kReservedSize = 1024;
+  ngram::Metadata* metadata = nullptr;
+  size_t image_size = 0;
+  auto allocate_image = [&](size_t size) -> void* {
+    image_size = size;
+    size_t capacity = sizeof(ngram::Metadata) + image_size + kReservedSize;
+    LOG(INFO) << "n-gram model: " << num_ngrams << " n-grams, "
+              << "double array " << image_size << " bytes.";
+    if (!Create(capacity)) {
+      LOG(ERROR) << "Error creating n-gram model '" << file_name() << "'.";
+      return nullptr;
+    }
+    metadata = Allocate<ngram::Metadata>();
+    if (!metadata) {
+      LOG(ERROR) << "Error creating metadata in file '" << file_name() << "'.";
+      return nullptr;
+    }
+    char* array = AllocateUninitialized<char>(image_size);
+    if (!array) {
+      LOG(ERROR) << "Error creating double-array image.";
+    }
+    return array;
+  };
+  if (num_ngrams == 0 ||
+      0 != trie_->build_in_place(num_ngrams, &keys[0], allocate_image,
+                                 &lengths[0], &values[0])) {
+    LOG(ERROR) << "Error building double-array trie.";
+    return false;
+  }
+  metadata->num_ngrams = num_ngrams;
+  metadata->max_context_length = max_context_length;
+  metadata->score_step = static_cast<float>(score_step);
+  metadata->double_array = const_cast<char*>(
+      static_cast<const char*>(trie_->array()));
+  metadata->double_array_size = trie_->size();
+  metadata_ = metadata;
+  size_t section_begin = metadata->double_array.get() - address();
+  sections_ = CreateSectionDirectory({{ngram::kDoubleArraySection,
+                                       section_begin,
+                                       section_begin + image_size}});
+  if (!sections_) {
+    LOG(ERROR) << "Error creating section directory.";
+    return false;
+  }
+  metadata->sections = sections_;
+  std::strncpy(metadata->format, kNgramModelFormat,
+               ngram::Metadata::kFormatMaxLength);
+  return true;
+}
+
+bool NgramModel::Verify() {
+  return IsOpen() && VerifySections(sections_);
+}
+
+bool NgramModel::Query(const string& context,
+                       const string& word,
+                       size_t min_context_length,
+                       size_t max_context_length,
+                       double* score) const {
+  if (!metadata_ || word.empty())
+    return false;
+  max_context_length = (std::min)({max_context_length,
+                                   this->max_context_length(),
+                                   kMaxContextLength});
+  // beginnings of the last characters of the context, nearest first
+  size_t starts[kMaxContextLength];
+  size_t num_starts = 0;
+  for (size_t i = context.length();
+       i > 0 && num_starts < max_context_length; ) {
+    if ((static_cast<unsigned char>(context[--i]) & 0xc0) != 0x80) {
+      starts[num_starts++] = i;
+    }
+  }
+  const char delimiter = kContextDelimiter;
+  for (size_t k = num_starts; k > 0 && k >= min_context_length; --k) {
+    size_t node_pos = 0;
+    size_t key_pos = 0;
+    const size_t start = starts[k - 1];
+    if (trie_->traverse(context.data() + start, node_pos, key_pos,
+                        context.length() - start) == -2)
+      continue;
+    key_pos = 0;
+    if (trie_->traverse(&delimiter, node_pos, key_pos, 1) == -2)
+      continue;
+    key_pos = 0;
+    int value = trie_->traverse(word.data(), node_pos, key_pos, word.length());
+    if (value >= 0) {
+      *score = -value * metadata_->score_step;
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t NgramModel::array_size() const {
+  return trie_->size();
+}
+
+}  // namespace rime
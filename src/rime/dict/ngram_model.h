@@ -0,0 +1,87 @@
+//
+// Copyright RIME Developers
+// Distributed under the BSD License
+//
+
+#ifndef RIME_NGRAM_MODEL_H_
+#define RIME_NGRAM_MODEL_H_
+
+#include <darts.h>
+#include <rime_api.h>
+#include <rime/common.h>
+#include <rime/dict/mapped_file.h>
+
+namespace rime {
+
+namespace ngram {
+
+const uint32_t kDoubleArraySection = SectionType('D', 'A', 'R', 'T');
+
+struct Metadata {
+  static const int kFormatMaxLength = 32;
+  char format[kFormatMaxLength];
+  uint32_t num_ngrams;
+  // of the longest context, in characters
+  uint32_t max_context_length;
+  // a stored value v stands for the log probability -v * score_step
+  float score_step;
+  uint32_t double_array_size;
+  OffsetPtr<char> double_array;
+  OffsetPtr<SectionDirectory> sections;
+};
+
+// an n-gram of words with the number of times it occurs in the corpus.
+struct Count {
+  vector<string> words;
+  double count;
+};
+
+}  // namespace ngram
+
+// log probabilities of words following a context of one or more words.
+// keys in the double-array trie are the concatenated context words, a tab
+// and the word; values are quantized log probabilities. as word boundaries
+// are not marked in the key, a context can be matched against the tail of
+// any text.
+class NgramModel : public MappedFile {
+ public:
+  static const char kContextDelimiter = '\t';
+  // upper bound of the context length in characters
+  static const size_t kMaxContextLength = 8;
+
+  RIME_API explicit NgramModel(const string& file_name);
+
+  RIME_API bool Load();
+  RIME_API bool Save();
+  // counts of single words are taken as counts of contexts; if a context is
+  // not counted, it counts as many as all n-grams following it.
+  RIME_API bool Build(const vector<ngram::Count>& counts);
+  // checks the integrity of all sections.
+  RIME_API bool Verify();
+
+  // looks up the longest tail of the context between min_context_length
+  // and max_context_length characters, that is followed by the word in
+  // an n-gram. returns false if there is none.
+  RIME_API bool Query(const string& context,
+                      const string& word,
+                      size_t min_context_length,
+                      size_t max_context_length,
+                      double* score) const;
+
+  size_t num_ngrams() const {
+    return metadata_ ? metadata_->num_ngrams : 0;
+  }
+  size_t max_context_length() const {
+    return metadata_ ? metadata_->max_context_length : 0;
+  }
+  RIME_API size_t array_size() const;
+
+ protected:
+  the<Darts::DoubleArray> trie_;
+  ngram::Metadata* metadata_ = nullptr;
+  SectionDirectory* sections_ = nullptr;
+};
+
+}  // namespace rime
+
+#endif  // RIME_NGRAM_MODEL_H_
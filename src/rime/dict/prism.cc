@@ -7,7 +7,7 @@
 //
 #include <cfloat>
 #include <cstring>
-#include <queue>
+#include <algorithm>
 #include <rime/algo/algebra.h>
 #include <rime/dict/prism.h>
 
@@ -16,13 +16,19 @@ namespace rime {
 namespace {
 
 struct node_t {
-  string key;
   size_t node_pos;
+  size_t key_length;
 };
 
 }  // namespace
 
-const char kPrismFormat[] = "Rime::Prism/3.0";
+const char kPrismFormat[] = "Rime::Prism/3.2";
+// precomputed completion lists are available since v3.1
+const double kPrismFormatCompletion = 3.1;
+// regions of the file are listed in a section directory since v3.2
+const double kPrismFormatSections = 3.2;
+// upper bound of the size of the completion index
+const size_t kMaxCompletionSlots = 1 << 16;
 
 const char kPrismFormatPrefix[] = "Rime::Prism/";
 const size_t kPrismFormatPrefixLen = sizeof(kPrismFormatPrefix) - 1;
@@ -106,11 +112,24 @@ bool Prism::Load() {
   size_t array_size = metadata_->double_array_size;
   LOG(INFO) << "found double array image of size " << array_size << ".";
   trie_->set_array(array, array_size);
+  Prefetch(array, trie_->total_size());
 
   spelling_map_ = NULL;
   if (format_ > 1.0 - DBL_EPSILON) {
     spelling_map_ = metadata_->spelling_map.get();
   }
+  completion_index_ = NULL;
+  completion_depth_ = 0;
+  if (format_ >= kPrismFormatCompletion - DBL_EPSILON &&
+      metadata_->completion_index) {
+    completion_index_ = metadata_->completion_index.get();
+    completion_depth_ = metadata_->completion_depth;
+  }
+  sections_ = NULL;
+  if (format_ >= kPrismFormatSections - DBL_EPSILON) {
+    sections_ = metadata_->sections.get();
+  }
+  InitializeAlphabetRanks();
   return true;
 }
 
@@ -120,22 +139,28 @@ bool Prism::Save() {
     LOG(ERROR) << "the trie has not been constructed!";
     return false;
   }
-  return ShrinkToFit();
+  // the double array lives in the file; map it again once resized.
+  return ShrinkToFit() && Load();
 }
 bool Prism::Build(const Syllabary& syllabary,
                   const Script* script,
                   uint32_t dict_file_checksum,
-                  uint32_t schema_file_checksum) {
-  // building double-array trie
+                  uint32_t schema_file_checksum,
+                  size_t completion_depth) {
   size_t num_syllables = syllabary.size();
   size_t num_spellings = script ? script->size() : syllabary.size();
   vector<const char*> keys(num_spellings);
   size_t key_id = 0;
   size_t map_size = 0;
+  size_t tips_size = 0;
   if (script) {
     for (auto it = script->begin(); it != script->end(); ++it, ++key_id) {
       keys[key_id] = it->first.c_str();
       map_size += it->second.size();
+      for (const auto& spelling : it->second) {
+        if (!spelling.properties.tips.empty())
+          tips_size += spelling.properties.tips.length() + 1;
+      }
     }
   }
   else {
@@ -143,55 +168,92 @@ bool Prism::Build(const Syllabary& syllabary,
       keys[key_id] = it->c_str();
     }
   }
-  if (0 != trie_->build(num_spellings, &keys[0])) {
-    LOG(ERROR) << "Error building double-array trie.";
-    return false;
+  set<char> alphabet;
+  for (size_t i = 0; i < num_spellings; ++i)
+    for (const char* p = keys[i]; *p; ++p)
+      alphabet.insert(*p);
+  size_t num_slots = 1;
+  for (size_t depth = 0; depth < completion_depth; ++depth) {
+    if (num_slots * (alphabet.size() + 1) > kMaxCompletionSlots) {
+      LOG(WARNING) << "completion depth limited to " << depth << ".";
+      completion_depth = depth;
+      break;
+    }
+    num_slots *= alphabet.size() + 1;
   }
-  // creating prism file
-  size_t array_size = trie_->size();
-  size_t image_size = trie_->total_size();
-  const size_t kDescriptorExtraSize = 12;
-  size_t estimated_map_size = num_spellings * 12 +
-      map_size * (4 + sizeof(prism::SpellingDescriptor) + kDescriptorExtraSize);
+  // the file is sized up front so that nothing is remapped while building;
+  // the estimates below are upper bounds.
+  size_t map_capacity = !script ? 0 :
+      sizeof(prism::SpellingMap) +
+      num_spellings * (sizeof(prism::SpellingMapItem) +
+                       alignof(prism::SpellingDescriptor)) +
+      map_size * sizeof(prism::SpellingDescriptor) + tips_size;
+  // every key appears in at most one completion list per prefix length.
+  size_t completion_capacity = completion_depth == 0 ? 0 :
+      sizeof(prism::CompletionIndex) +
+      num_slots * sizeof(prism::CompletionList) +
+      completion_depth * num_spellings * sizeof(prism::Completion);
   const size_t kReservedSize = 1024;
-  if (!Create(image_size + estimated_map_size + kReservedSize)) {
-    LOG(ERROR) << "Error creating prism file '" << file_name() << "'.";
-    return false;
-  }
-  // creating metadata
-  auto metadata = Allocate<prism::Metadata>();
-  if (!metadata) {
-    LOG(ERROR) << "Error creating metadata in file '" << file_name() << "'.";
+  // building double-array trie directly in the file, so that there is no
+  // copy of it on the heap besides the builder's.
+  prism::Metadata* metadata = nullptr;
+  size_t image_size = 0;
+  auto allocate_image = [&](size_t size) -> void* {
+    image_size = size;
+    size_t capacity = sizeof(prism::Metadata) + image_size +
+        map_capacity + completion_capacity + kReservedSize;
+    LOG(INFO) << "prism: " << num_spellings << " spellings, "
+              << "double array " << image_size << " bytes, "
+              << "spelling map " << map_capacity << " bytes, "
+              << "completion index " << completion_capacity << " bytes; "
+              << "file capacity " << capacity << " bytes.";
+    if (!Create(capacity)) {
+      LOG(ERROR) << "Error creating prism file '" << file_name() << "'.";
+      return nullptr;
+    }
+    // creating metadata
+    metadata = Allocate<prism::Metadata>();
+    if (!metadata) {
+      LOG(ERROR) << "Error creating metadata in file '" << file_name() << "'.";
+      return nullptr;
+    }
+    // saving double-array image; the builder fills it in while releasing
+    // its own copy.
+    char* array = AllocateUninitialized<char>(image_size);
+    if (!array) {
+      LOG(ERROR) << "Error creating double-array image.";
+    }
+    return array;
+  };
+  if (0 != trie_->build_in_place(num_spellings, &keys[0], allocate_image)) {
+    LOG(ERROR) << "Error building double-array trie.";
     return false;
   }
   metadata->dict_file_checksum = dict_file_checksum;
   metadata->schema_file_checksum = schema_file_checksum;
   metadata->num_syllables = num_syllables;
   metadata->num_spellings = num_spellings;
+  metadata->double_array = const_cast<char*>(
+      static_cast<const char*>(trie_->array()));
+  metadata->double_array_size = trie_->size();
   metadata_ = metadata;
+  vector<SectionSpan> sections;
+  size_t section_begin = metadata->double_array.get() - address();
+  sections.push_back({prism::kDoubleArraySection,
+                      section_begin, section_begin + image_size});
   // alphabet
   {
-    set<char> alphabet;
-    for (size_t i = 0; i < num_spellings; ++i)
-      for (const char* p = keys[i]; *p; ++p)
-        alphabet.insert(*p);
     char* p = metadata->alphabet;
     set<char>::const_iterator c = alphabet.begin();
     for (; c != alphabet.end(); ++p, ++c)
       *p = *c;
     *p = '\0';
   }
-  // saving double-array image
-  char* array = Allocate<char>(image_size);
-  if (!array) {
-    LOG(ERROR) << "Error creating double-array image.";
-    return false;
-  }
-  std::memcpy(array, trie_->array(), image_size);
-  metadata->double_array = array;
-  metadata->double_array_size = array_size;
+  format_ = atof(&kPrismFormat[kPrismFormatPrefixLen]);
+  InitializeAlphabetRanks();
   // building spelling map
   if (script) {
+    section_begin = file_size();
     map<string, SyllableId> syllable_to_id;
     SyllableId syll_id = 0;
     for (auto it = syllabary.begin(); it != syllabary.end(); ++it) {
@@ -227,13 +289,36 @@ bool Prism::Build(const Syllabary& syllabary,
     }
     metadata->spelling_map = spelling_map;
     spelling_map_ = spelling_map;
+    sections.push_back({prism::kSpellingMapSection,
+                        section_begin, file_size()});
+  }
+  if (completion_depth > 0) {
+    section_begin = file_size();
+    if (!BuildCompletionIndex(completion_depth)) {
+      LOG(ERROR) << "Error creating completion index.";
+      return false;
+    }
+    sections.push_back({prism::kCompletionIndexSection,
+                        section_begin, file_size()});
   }
+  sections_ = CreateSectionDirectory(sections);
+  if (!sections_) {
+    LOG(ERROR) << "Error creating section directory.";
+    return false;
+  }
+  metadata->sections = sections_;
   // at last, complete the metadata
   std::strncpy(metadata->format, kPrismFormat,
                prism::Metadata::kFormatMaxLength);
+  LOG(INFO) << "prism: " << file_size() << " of " << capacity()
+            << " bytes in use.";
   return true;
 }
 
+bool Prism::Verify() {
+  return IsOpen() && VerifySections(sections_);
+}
+
 bool Prism::HasKey(const string& key) {
   int value = trie_->exactMatchSearch<int>(key.c_str());
   return value != -1;
@@ -261,11 +346,104 @@ void Prism::CommonPrefixSearch(const string& key,
   result->resize(num_results);
 }
 
+bool Prism::BuildCompletionIndex(size_t depth) {
+  size_t radix = strlen(alphabet()) + 1;
+  size_t num_slots = 1;
+  for (size_t i = 0; i < depth; ++i)
+    num_slots *= radix;
+  auto index = CreateArray<prism::CompletionList>(num_slots);
+  if (!index) {
+    return false;
+  }
+  completion_index_ = index;
+  completion_depth_ = depth;
+  metadata_->completion_index = index;
+  metadata_->completion_depth = depth;
+  // visit valid prefixes breadth-first
+  vector<string> prefixes{string()};
+  vector<Match> completions;
+  for (size_t length = 1; length <= depth; ++length) {
+    vector<string> longer_prefixes;
+    for (const string& prefix : prefixes) {
+      for (const char* c = alphabet(); *c; ++c) {
+        string key = prefix + *c;
+        Traverse(key, &completions, 0);
+        if (completions.empty())
+          continue;
+        auto& list(index->at[CompletionSlot(key)]);
+        list.size = completions.size();
+        list.at = Allocate<prism::Completion>(completions.size());
+        if (!list.at) {
+          return false;
+        }
+        for (size_t i = 0; i < completions.size(); ++i) {
+          list.at[i].value = completions[i].value;
+          list.at[i].length = completions[i].length;
+        }
+        longer_prefixes.push_back(key);
+      }
+    }
+    prefixes.swap(longer_prefixes);
+  }
+  return true;
+}
+
+const char* Prism::alphabet() const {
+  return (format_ > 1.0 - DBL_EPSILON) ? metadata_->alphabet
+                                       : kDefaultAlphabet;
+}
+
+void Prism::InitializeAlphabetRanks() {
+  std::memset(alphabet_ranks_, 0, sizeof(alphabet_ranks_));
+  uint8_t rank = 0;
+  for (const char* c = alphabet(); *c; ++c) {
+    alphabet_ranks_[static_cast<uint8_t>(*c)] = ++rank;
+  }
+}
+
+int Prism::CompletionSlot(const string& prefix) const {
+  if (!completion_index_ ||
+      prefix.empty() ||
+      prefix.length() > completion_depth_)
+    return -1;
+  size_t radix = strlen(alphabet()) + 1;
+  size_t slot = 0;
+  size_t weight = 1;
+  for (char c : prefix) {
+    uint8_t rank = alphabet_ranks_[static_cast<uint8_t>(c)];
+    if (!rank)
+      return -1;
+    slot += rank * weight;
+    weight *= radix;
+  }
+  return slot < completion_index_->size ? static_cast<int>(slot) : -1;
+}
+
 void Prism::ExpandSearch(const string& key,
                          vector<Match>* result,
                          size_t limit) {
   if (!result)
     return;
+  if (completion_index_ &&
+      !key.empty() && key.length() <= completion_depth_) {
+    result->clear();
+    int slot = CompletionSlot(key);
+    if (slot < 0)
+      return;
+    const auto& list(completion_index_->at[slot]);
+    size_t count = limit ? (std::min)(limit, size_t(list.size)) : list.size;
+    result->reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+      result->push_back(Match{list.at[i].value, list.at[i].length});
+    }
+    return;
+  }
+  Traverse(key, result, limit);
+}
+
+void Prism::Traverse(const string& key,
+                     vector<Match>* result,
+                     size_t limit) {
   result->clear();
   size_t count = 0;
   size_t node_pos = 0;
@@ -279,27 +457,26 @@ void Prism::ExpandSearch(const string& key,
     if (limit && ++count >= limit)
       return;
   }
-  std::queue<node_t> q;
-  q.push({key, node_pos});
-  while(!q.empty()) {
-    node_t node = q.front();
-    q.pop();
-    const char* c = (format_ > 1.0 - DBL_EPSILON) ? metadata_->alphabet
-                                                  : kDefaultAlphabet;
-    for (; *c; ++c) {
-      string k = node.key + *c;
-      size_t k_pos = node.key.length();
+  // breadth-first, stepping one character at a time from each node;
+  // the queue is kept per thread to avoid reallocating it on every search.
+  static thread_local vector<node_t> q;
+  q.clear();
+  q.push_back({node_pos, key.length()});
+  for (size_t head = 0; head < q.size(); ++head) {
+    node_t node = q[head];
+    for (const char* c = alphabet(); *c; ++c) {
       size_t n_pos = node.node_pos;
-      ret = trie_->traverse(k.c_str(), n_pos, k_pos);
+      size_t k_pos = 0;
+      ret = trie_->traverse(c, n_pos, k_pos, 1);
       if (ret <= -2) {
         //ignore
       }
       else if (ret == -1) {
-        q.push({k, n_pos});
+        q.push_back({n_pos, node.key_length + 1});
       }
       else {
-        q.push({k, n_pos});
-        result->push_back(Match{ret, k_pos});
+        q.push_back({n_pos, node.key_length + 1});
+        result->push_back(Match{ret, node.key_length + 1});
         if (limit && ++count >= limit)
           return;
       }
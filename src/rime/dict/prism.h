@@ -31,6 +31,22 @@ struct SpellingDescriptor {
 using SpellingMapItem = List<SpellingDescriptor>;
 using SpellingMap = Array<SpellingMapItem>;
 
+struct Completion {
+  int32_t value;
+  uint32_t length;
+};
+
+// all keys starting with a prefix, in the order ExpandSearch finds them
+using CompletionList = List<Completion>;
+// indexed by prefix; see Prism::CompletionSlot()
+using CompletionIndex = Array<CompletionList>;
+
+// v3.2 section types
+
+const uint32_t kDoubleArraySection = SectionType('D', 'A', 'R', 'T');
+const uint32_t kSpellingMapSection = SectionType('S', 'P', 'E', 'L');
+const uint32_t kCompletionIndexSection = SectionType('C', 'O', 'M', 'P');
+
 struct Metadata {
   static const int kFormatMaxLength = 32;
   char format[kFormatMaxLength];
@@ -43,6 +59,11 @@ struct Metadata {
   // v1.0
   OffsetPtr<SpellingMap> spelling_map;
   char alphabet[256];
+  // v3.1
+  uint32_t completion_depth;
+  OffsetPtr<CompletionIndex> completion_index;
+  // v3.2
+  OffsetPtr<SectionDirectory> sections;
 };
 
 }  // namespace prism
@@ -71,16 +92,25 @@ class Prism : public MappedFile {
 
   RIME_API bool Load();
   RIME_API bool Save();
+  // completion lists are precomputed for prefixes up to completion_depth
+  // characters long.
   RIME_API bool Build(const Syllabary& syllabary,
                       const Script* script = nullptr,
                       uint32_t dict_file_checksum = 0,
-                      uint32_t schema_file_checksum = 0);
+                      uint32_t schema_file_checksum = 0,
+                      size_t completion_depth = 0);
 
   RIME_API bool HasKey(const string& key);
   RIME_API bool GetValue(const string& key, int* value) const;
   RIME_API void CommonPrefixSearch(const string& key, vector<Match>* result);
   RIME_API void ExpandSearch(const string& key, vector<Match>* result, size_t limit);
   SpellingAccessor QuerySpelling(SyllableId spelling_id);
+  // checks the integrity of all sections, if the format has any.
+  RIME_API bool Verify();
+  // a section of the loaded prism, or nullptr if there is none of the type.
+  const Section* FindSection(uint32_t type) const {
+    return MappedFile::FindSection(sections_, type);
+  }
 
   RIME_API size_t array_size() const;
 
@@ -89,9 +119,21 @@ class Prism : public MappedFile {
   Darts::DoubleArray& trie() const { return *trie_; }
 
  protected:
+  const char* alphabet() const;
+  void InitializeAlphabetRanks();
+  void Traverse(const string& key, vector<Match>* result, size_t limit);
+  bool BuildCompletionIndex(size_t depth);
+  // position of the completion list for a prefix, or -1 if out of range.
+  int CompletionSlot(const string& prefix) const;
+
   the<Darts::DoubleArray> trie_;
   prism::Metadata* metadata_ = nullptr;
   prism::SpellingMap* spelling_map_ = nullptr;
+  prism::CompletionIndex* completion_index_ = nullptr;
+  SectionDirectory* sections_ = nullptr;
+  size_t completion_depth_ = 0;
+  // 1-based position of each character in the alphabet, 0 if absent
+  uint8_t alphabet_ranks_[256] = {};
   double format_ = 0.0;
 };
 
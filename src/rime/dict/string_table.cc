@@ -12,8 +12,16 @@
 
 namespace rime {
 
-StringTable::StringTable(const char* ptr, size_t size) {
+const size_t StringTable::kNumCacheLocks;
+
+StringTable::StringTable(const char* ptr, size_t size, size_t cache_capacity) {
   trie_.map(ptr, size);
+  if (cache_capacity > 0) {
+    size_t cache_size = 1;
+    while (cache_size < cache_capacity)
+      cache_size <<= 1;
+    cache_.resize(cache_size);
+  }
 }
 
 bool StringTable::HasKey(const string& key) {
@@ -54,6 +62,29 @@ void StringTable::Predict(const string& query,
 }
 
 string StringTable::GetString(StringId string_id) {
+  if (cache_.empty()) {
+    return Decode(string_id);
+  }
+  // cache_ is sized to a power of 2
+  size_t index = string_id & (cache_.size() - 1);
+  CacheSlot& slot = cache_[index];
+  std::mutex& cache_lock = cache_locks_[index % kNumCacheLocks];
+  num_lookups_.fetch_add(1, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lock(cache_lock);
+    if (slot.id == string_id) {
+      num_cache_hits_.fetch_add(1, std::memory_order_relaxed);
+      return slot.text;
+    }
+  }
+  string text = Decode(string_id);
+  std::lock_guard<std::mutex> lock(cache_lock);
+  slot.id = string_id;
+  slot.text = text;
+  return text;
+}
+
+string StringTable::Decode(StringId string_id) {
   marisa::Agent agent;
   agent.set_query(string_id);
   try {
@@ -8,6 +8,8 @@
 #ifndef RIME_STRING_TABLE_H_
 #define RIME_STRING_TABLE_H_
 
+#include <atomic>
+#include <mutex>
 #include <utility>
 #include <marisa.h>
 #include <rime/common.h>
@@ -22,7 +24,11 @@ class StringTable {
  public:
   StringTable() = default;
   virtual ~StringTable() = default;
-  StringTable(const char* ptr, size_t size);
+  // keeps decoded strings in a direct-mapped cache of at least
+  // `cache_capacity` slots indexed by string id; 0 disables the cache.
+  // the cache is fixed for the lifetime of the table, so that lookups
+  // from several threads need only lock the slot they touch.
+  StringTable(const char* ptr, size_t size, size_t cache_capacity = 0);
 
   bool HasKey(const string& key);
   StringId Lookup(const string& key);
@@ -35,8 +41,24 @@ class StringTable {
   size_t NumKeys() const;
   size_t BinarySize() const;
 
+  size_t num_lookups() const { return num_lookups_; }
+  size_t num_cache_hits() const { return num_cache_hits_; }
+
  protected:
+  string Decode(StringId string_id);
+
   marisa::Trie trie_;
+
+  struct CacheSlot {
+    StringId id = kInvalidStringId;
+    string text;
+  };
+  // slots are guarded by one of the locks, chosen by slot index.
+  static const size_t kNumCacheLocks = 16;
+  vector<CacheSlot> cache_;
+  std::mutex cache_locks_[kNumCacheLocks];
+  std::atomic<size_t> num_lookups_{0};
+  std::atomic<size_t> num_cache_hits_{0};
 };
 
 class StringTableBuilder: public StringTable {
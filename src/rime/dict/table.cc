@@ -7,7 +7,7 @@
 #include <cfloat>
 #include <cstring>
 #include <algorithm>
-#include <queue>
+#include <bitset>
 #include <utility>
 #include <rime/common.h>
 #include <rime/algo/syllabifier.h>
@@ -15,8 +15,14 @@
 
 namespace rime {
 
-const char kTableFormatLatest[] = "Rime::Table/4.0";
-const int kTableFormatLowestCompatible = 4.0;
+const char kTableFormatLatest[] = "Rime::Table/4.3";
+const double kTableFormatLowestCompatible = 4.0;
+// rank directories are available since v4.1
+const double kTableFormatRankIndex = 4.1;
+// tail index entries are sorted by extra code since v4.2
+const double kTableFormatSortedTail = 4.2;
+// regions of the file are listed in a section directory since v4.3
+const double kTableFormatSections = 4.3;
 
 const char kTableFormatPrefix[] = "Rime::Table/";
 const size_t kTableFormatPrefixLen = sizeof(kTableFormatPrefix) - 1;
@@ -28,12 +34,12 @@ void IndexCode::clear() {
 
 SyllableId IndexCode::pop_back() {
   assert(size_ > 0);
-  return (*this)[size_--];
+  return (*this)[--size_];
 }
 
 void IndexCode::push_back(SyllableId syllable_id) {
-  assert(size_ < 3);
-  return (*this)[size_++] = syllable_id;
+  assert(size_ < kIndexCodeMaxLength);
+  (*this)[size_++] = syllable_id;
 }
 
 size_t IndexCode::size() const {
@@ -42,7 +48,8 @@ size_t IndexCode::size() const {
 
 class TableQuery {
  public:
-  TableQuery(table::Index* index) : lv1_index_(index) {
+  TableQuery(table::Index* index, table::RankIndex* rank_index = nullptr)
+      : lv1_index_(index), rank_index_(rank_index) {
     Reset();
   }
 
@@ -63,7 +70,8 @@ class TableQuery {
  protected:
   size_t level_ = 0;
   IndexCode index_code_;
-  vector<double> credibility_;
+  // accumulated credibility at each level
+  double credibility_[kIndexCodeMaxLength + 1] = {};
 
  private:
   bool Walk(SyllableId syllable_id);
@@ -72,6 +80,9 @@ class TableQuery {
   table::TrunkIndex* lv2_index_ = nullptr;
   table::TrunkIndex* lv3_index_ = nullptr;
   table::TailIndex* lv4_index_ = nullptr;
+  table::RankIndex* rank_index_ = nullptr;
+  table::TrunkRank* lv2_rank_ = nullptr;
+  table::TrunkRank* lv3_rank_ = nullptr;
 };
 
 TableAccessor::TableAccessor(const IndexCode& index_code,
@@ -153,9 +164,9 @@ bool TableQuery::Advance(SyllableId syllable_id, double credibility) {
   if (!Walk(syllable_id)) {
     return false;
   }
+  credibility_[level_ + 1] = credibility_[level_] + credibility;
   ++level_;
   index_code_.push_back(syllable_id);
-  credibility_.push_back(credibility_.back() + credibility);
   return true;
 }
 
@@ -165,7 +176,6 @@ bool TableQuery::Backdate() {
   --level_;
   if (index_code_.size() > level_) {
     index_code_.pop_back();
-    credibility_.pop_back();
   }
   return true;
 }
@@ -173,8 +183,7 @@ bool TableQuery::Backdate() {
 void TableQuery::Reset() {
   level_ = 0;
   index_code_.clear();
-  credibility_.clear();
-  credibility_.push_back(0.0);
+  credibility_[0] = 0.0;
 }
 
 inline static bool node_less(const table::TrunkIndexNode& a,
@@ -191,6 +200,36 @@ static table::TrunkIndexNode* find_node(table::TrunkIndexNode* first,
   return it == last || key < it->key ? last : it;
 }
 
+// locates the node of a key in O(1) if the trunk index has a rank directory,
+// otherwise by binary search.
+static table::TrunkIndexNode* find_node(table::TrunkIndex* index,
+                                        const table::TrunkRank* rank,
+                                        SyllableId key) {
+  if (rank && rank->num_blocks > 0) {
+    if (key < rank->min_key)
+      return nullptr;
+    size_t offset = static_cast<size_t>(key - rank->min_key);
+    if (offset >= rank->num_blocks * 64)
+      return nullptr;
+    const table::RankBlock& block = rank->blocks[offset / 64];
+    uint64_t bit = uint64_t(1) << (offset % 64);
+    if (!(block.bits & bit))
+      return nullptr;
+    return &index->at[block.rank +
+                      std::bitset<64>(block.bits & (bit - 1)).count()];
+  }
+  auto node = find_node(index->begin(), index->end(), key);
+  return node == index->end() ? nullptr : node;
+}
+
+static table::TrunkRank* child_rank(const table::TrunkRank* rank,
+                                    const table::TrunkIndex* index,
+                                    const table::TrunkIndexNode* node) {
+  if (!rank || !rank->children)
+    return nullptr;
+  return rank->children[node - index->begin()].get();
+}
+
 bool TableQuery::Walk(SyllableId syllable_id) {
   if (level_ == 0) {
     if (!lv1_index_ ||
@@ -201,22 +240,26 @@ bool TableQuery::Walk(SyllableId syllable_id) {
     if (!node->next_level)
       return false;
     lv2_index_ = &node->next_level->trunk();
+    lv2_rank_ = rank_index_ &&
+        syllable_id < static_cast<SyllableId>(rank_index_->size) ?
+        rank_index_->at[syllable_id].get() : nullptr;
   }
   else if (level_ == 1) {
     if (!lv2_index_)
       return false;
-    auto node = find_node(lv2_index_->begin(), lv2_index_->end(), syllable_id);
-    if (node == lv2_index_->end())
+    auto node = find_node(lv2_index_, lv2_rank_, syllable_id);
+    if (!node)
       return false;
     if (!node->next_level)
       return false;
     lv3_index_ = &node->next_level->trunk();
+    lv3_rank_ = child_rank(lv2_rank_, lv2_index_, node);
   }
   else if (level_ == 2) {
     if (!lv3_index_)
       return false;
-    auto node = find_node(lv3_index_->begin(), lv3_index_->end(), syllable_id);
-    if (node == lv3_index_->end())
+    auto node = find_node(lv3_index_, lv3_rank_, syllable_id);
+    if (!node)
       return false;
     if (!node->next_level)
       return false;
@@ -235,7 +278,7 @@ inline static IndexCode add_syllable(IndexCode code, SyllableId syllable_id) {
 
 TableAccessor TableQuery::Access(SyllableId syllable_id,
                                  double credibility) const {
-  credibility += credibility_.back();
+  credibility += credibility_[level_];
   if (level_ == 0) {
     if (!lv1_index_ ||
         syllable_id < 0 ||
@@ -247,10 +290,11 @@ TableAccessor TableQuery::Access(SyllableId syllable_id,
   }
   else if (level_ == 1 || level_ == 2) {
     auto index = (level_ == 1) ? lv2_index_ : lv3_index_;
+    auto rank = (level_ == 1) ? lv2_rank_ : lv3_rank_;
     if (!index)
       return TableAccessor();
-    auto node = find_node(index->begin(), index->end(), syllable_id);
-    if (node == index->end())
+    auto node = find_node(index, rank, syllable_id);
+    if (!node)
       return TableAccessor();
     return TableAccessor(add_syllable(index_code_, syllable_id),
                          &node->entries, credibility);
@@ -273,11 +317,21 @@ TableAccessor TableQuery::Access(SyllableId syllable_id,
 // }
 
 string Table::GetString(const table::StringType& x) {
-  return string_table_->GetString(x.str_id());
+  if (x.str_id() < num_shared_strings_)
+    return primary_->GetString(x);
+  return string_table_->GetString(x.str_id() - num_shared_strings_);
 }
 
 bool Table::AddString(const string& src, table::StringType* dest,
                       double weight) {
+  if (num_shared_strings_) {
+    StringId id = primary_->string_table_->Lookup(src);
+    if (id != kInvalidStringId) {
+      dest->str_id() = id;
+      return true;
+    }
+    own_string_references_.push_back(&dest->str_id());
+  }
   string_table_builder_->Add(src, weight, &dest->str_id());
   return true;
 }
@@ -299,12 +353,18 @@ bool Table::OnBuildFinish() {
   string_table_builder_->Dump(image, image_size);
   metadata_->string_table = image;
   metadata_->string_table_size = image_size;
+  // ids of a pack's own strings follow those of the primary table
+  for (StringId* reference : own_string_references_) {
+    *reference += num_shared_strings_;
+  }
+  own_string_references_.clear();
   return true;
 }
 
 bool Table::OnLoad() {
   string_table_.reset(new StringTable(metadata_->string_table.get(),
-                                      metadata_->string_table_size));
+                                      metadata_->string_table_size,
+                                      string_cache_size_));
   return true;
 }
 
@@ -312,6 +372,21 @@ Table::Table(const string& file_name) : MappedFile(file_name) {
 }
 
 Table::~Table() {
+  if (string_table_ && string_table_->num_lookups() > 0) {
+    LOG(INFO) << "string cache of " << file_name() << ": "
+              << string_table_->num_cache_hits() << " hits in "
+              << string_table_->num_lookups() << " lookups.";
+  }
+}
+
+void Table::set_string_cache_size(size_t size) {
+  if (size <= string_cache_size_)
+    return;
+  string_cache_size_ = size;
+  if (string_table_) {
+    LOG(INFO) << "string cache of " << file_name() << " resized to " << size
+              << " when the table is next loaded.";
+  }
 }
 
 bool Table::Load() {
@@ -344,8 +419,22 @@ bool Table::Load() {
     return false;
   }
 
+  sections_ = format_version >= kTableFormatSections - DBL_EPSILON ?
+      metadata_->sections.get() : nullptr;
+  num_shared_strings_ = 0;
+  if (auto pack = FindSection(table::kPackSection)) {
+    auto info = reinterpret_cast<const table::PackInfo*>(pack->data.get());
+    if (!primary_ || !primary_->IsOpen() ||
+        primary_->dict_file_checksum() != info->primary_checksum) {
+      LOG(ERROR) << "pack '" << file_name()
+                 << "' is not loaded with its primary table.";
+      Close();
+      return false;
+    }
+    num_shared_strings_ = info->num_shared_strings;
+  }
   syllabary_ = metadata_->syllabary.get();
-  if (!syllabary_) {
+  if (!syllabary_ && !FindSection(table::kPackSection)) {
     LOG(ERROR) << "syllabary not found.";
     Close();
     return false;
@@ -356,6 +445,12 @@ bool Table::Load() {
     Close();
     return false;
   }
+  rank_index_ = format_version >= kTableFormatRankIndex - DBL_EPSILON ?
+      metadata_->rank_index.get() : nullptr;
+  sorted_tail_ = format_version >= kTableFormatSortedTail - DBL_EPSILON;
+  // every lookup starts from the metadata and the head index
+  Prefetch(metadata_, sizeof(table::Metadata));
+  Prefetch(index_->begin(), index_->size * sizeof(table::HeadIndexNode));
 
   return OnLoad();
 }
@@ -371,15 +466,46 @@ bool Table::Save() {
   return ShrinkToFit();
 }
 
+bool Table::Verify() {
+  return IsOpen() && VerifySections(sections_);
+}
+
 uint32_t Table::dict_file_checksum() const {
   return metadata_ ? metadata_->dict_file_checksum : 0;
 }
 
 bool Table::Build(const Syllabary& syllabary, const Vocabulary& vocabulary,
                   size_t num_entries, uint32_t dict_file_checksum) {
+  primary_.reset();
+  num_shared_strings_ = 0;
+  return BuildFile(&syllabary, vocabulary, num_entries, dict_file_checksum);
+}
+
+bool Table::BuildPack(const an<Table>& primary,
+                      const Vocabulary& vocabulary,
+                      size_t num_entries,
+                      uint32_t dict_file_checksum,
+                      bool share_strings) {
+  if (!primary || !primary->IsOpen() || !primary->syllabary_) {
+    LOG(ERROR) << "the primary table is required to build a pack.";
+    return false;
+  }
+  primary_ = primary;
+  num_shared_strings_ =
+      share_strings ? primary->string_table_->NumKeys() : 0;
+  return BuildFile(nullptr, vocabulary, num_entries, dict_file_checksum);
+}
+
+bool Table::BuildFile(const Syllabary* syllabary,
+                      const Vocabulary& vocabulary,
+                      size_t num_entries,
+                      uint32_t dict_file_checksum) {
   const size_t kReservedSize = 4096;
-  size_t num_syllables = syllabary.size();
-  size_t estimated_file_size = kReservedSize + 32 * num_syllables + 64 * num_entries;
+  size_t num_syllables =
+      syllabary ? syllabary->size() : primary_->syllabary_->size;
+  // rank directories take up to 24 bytes per entry
+  size_t estimated_file_size =
+      kReservedSize + 32 * num_syllables + 88 * num_entries;
   LOG(INFO) << "building table.";
   LOG(INFO) << "num syllables: " << num_syllables;
   LOG(INFO) << "num entries: " << num_entries;
@@ -403,32 +529,73 @@ bool Table::Build(const Syllabary& syllabary, const Vocabulary& vocabulary,
     return false;
   }
 
-  LOG(INFO) << "creating syllabary.";
-  syllabary_ = CreateArray<table::StringType>(num_syllables);
-  if (!syllabary_) {
-    LOG(ERROR) << "Error creating syllabary.";
-    return false;
+  vector<SectionSpan> sections;
+  size_t section_begin = file_size();
+  if (!syllabary) {
+    LOG(INFO) << "using the syllabary of the primary table.";
+    auto info = Allocate<table::PackInfo>();
+    if (!info) {
+      LOG(ERROR) << "Error creating pack info.";
+      return false;
+    }
+    info->primary_checksum = primary_->dict_file_checksum();
+    info->num_shared_strings = num_shared_strings_;
+    syllabary_ = nullptr;
+    sections.push_back({table::kPackSection, section_begin, file_size()});
   }
   else {
-    size_t i = 0;
-    for (const string& syllable : syllabary) {
-      AddString(syllable, &syllabary_->at[i++], 0.0);
+    LOG(INFO) << "creating syllabary.";
+    syllabary_ = CreateArray<table::StringType>(num_syllables);
+    if (!syllabary_) {
+      LOG(ERROR) << "Error creating syllabary.";
+      return false;
     }
+    else {
+      size_t i = 0;
+      for (const string& syllable : *syllabary) {
+        AddString(syllable, &syllabary_->at[i++], 0.0);
+      }
+    }
+    metadata_->syllabary = syllabary_;
+    sections.push_back({table::kSyllabarySection, section_begin, file_size()});
   }
-  metadata_->syllabary = syllabary_;
 
   LOG(INFO) << "creating table index.";
+  section_begin = file_size();
   index_ = BuildIndex(vocabulary, num_syllables);
   if (!index_) {
     LOG(ERROR) << "Error creating table index.";
     return false;
   }
   metadata_->index = index_;
+  sections.push_back({table::kIndexSection, section_begin, file_size()});
 
+  LOG(INFO) << "creating rank index.";
+  section_begin = file_size();
+  rank_index_ = BuildRankIndex();
+  if (!rank_index_) {
+    LOG(ERROR) << "Error creating rank index.";
+    return false;
+  }
+  metadata_->rank_index = rank_index_;
+  sections.push_back({table::kRankIndexSection, section_begin, file_size()});
+
+  section_begin = file_size();
   if (!OnBuildFinish()) {
     return false;
   }
+  sections.push_back({table::kStringTableSection, section_begin, file_size()});
+
+  // entry texts are resolved when the string table is built, so checksums
+  // are taken after that.
+  sections_ = CreateSectionDirectory(sections);
+  if (!sections_) {
+    LOG(ERROR) << "Error creating section directory.";
+    return false;
+  }
+  metadata_->sections = sections_;
 
+  sorted_tail_ = true;
   // at last, complete the metadata
   std::strncpy(metadata_->format, kTableFormatLatest,
                table::Metadata::kFormatMaxLength);
@@ -516,8 +683,18 @@ table::TailIndex* Table::BuildTailIndex(const Code& prefix,
   if (!index) {
     return NULL;
   }
+  // sort by extra code so that lookups can narrow down the entries by
+  // binary search on each syllable beyond the index code.
+  DictEntryList entries(page.entries);
+  std::stable_sort(
+      entries.begin(), entries.end(),
+      [](const an<DictEntry>& a, const an<DictEntry>& b) {
+        return std::lexicographical_compare(
+            a->code.begin() + Code::kIndexCodeMaxLength, a->code.end(),
+            b->code.begin() + Code::kIndexCodeMaxLength, b->code.end());
+      });
   size_t count = 0;
-  for (const auto& src : page.entries) {
+  for (const auto& src : entries) {
     DLOG(INFO) << "count: " << count;
     DLOG(INFO) << "entry: " << src->text;
     auto& dest(index->at[count++]);
@@ -537,6 +714,86 @@ table::TailIndex* Table::BuildTailIndex(const Code& prefix,
   return index;
 }
 
+table::RankIndex* Table::BuildRankIndex() {
+  auto rank_index = CreateArray<OffsetPtr<table::TrunkRank>>(index_->size);
+  if (!rank_index) {
+    return NULL;
+  }
+  for (size_t i = 0; i < index_->size; ++i) {
+    const auto& node(index_->at[i]);
+    if (node.next_level) {
+      rank_index->at[i] = BuildTrunkRank(&node.next_level->trunk(), true);
+    }
+  }
+  return rank_index;
+}
+
+// builds a rank directory for trunk indices with enough keys that are not
+// too sparse, so that the bitmap stays smaller than the nodes themselves.
+table::TrunkRank* Table::BuildTrunkRank(table::TrunkIndex* trunk,
+                                        bool with_children) {
+  const size_t kMinRankedKeys = 8;
+  const size_t kMaxKeySparsity = 32;
+  size_t num_keys = trunk->size;
+  if (num_keys == 0) {
+    return NULL;
+  }
+  vector<table::TrunkRank*> children;
+  if (with_children) {
+    for (const auto& node : *trunk) {
+      children.push_back(node.next_level ?
+                         BuildTrunkRank(&node.next_level->trunk(), false) :
+                         NULL);
+    }
+    if (std::find_if(children.begin(), children.end(),
+                     [](table::TrunkRank* x) { return x != NULL; }) ==
+        children.end()) {
+      children.clear();
+    }
+  }
+  SyllableId min_key = trunk->at[0].key;
+  size_t range = trunk->at[num_keys - 1].key - min_key + 1;
+  size_t num_blocks = (range + 63) / 64;
+  bool use_bitmap = num_keys >= kMinRankedKeys &&
+                    range <= kMaxKeySparsity * num_keys;
+  if (!use_bitmap && children.empty()) {
+    return NULL;
+  }
+  auto rank = Allocate<table::TrunkRank>();
+  if (!rank) {
+    return NULL;
+  }
+  rank->min_key = min_key;
+  if (use_bitmap) {
+    auto blocks = Allocate<table::RankBlock>(num_blocks);
+    if (!blocks) {
+      return NULL;
+    }
+    for (const auto& node : *trunk) {
+      size_t offset = node.key - min_key;
+      blocks[offset / 64].bits |= uint64_t(1) << (offset % 64);
+    }
+    uint32_t count = 0;
+    for (size_t i = 0; i < num_blocks; ++i) {
+      blocks[i].rank = count;
+      count += std::bitset<64>(blocks[i].bits).count();
+    }
+    rank->num_blocks = num_blocks;
+    rank->blocks = blocks;
+  }
+  if (!children.empty()) {
+    auto child_ranks = Allocate<OffsetPtr<table::TrunkRank>>(num_keys);
+    if (!child_ranks) {
+      return NULL;
+    }
+    for (size_t i = 0; i < num_keys; ++i) {
+      child_ranks[i] = children[i];
+    }
+    rank->children = child_ranks;
+  }
+  return rank;
+}
+
 Array<table::Entry>* Table::BuildEntryArray(const DictEntryList& entries) {
   auto array = CreateArray<table::Entry>(entries.size());
   if (!array) {
@@ -581,6 +838,8 @@ bool Table::BuildEntry(const DictEntry& dict_entry, table::Entry* entry) {
 }
 
 bool Table::GetSyllabary(Syllabary* result) {
+  if (!syllabary_ && primary_)
+    return primary_->GetSyllabary(result);
   if (!result || !syllabary_)
     return false;
   for (size_t i = 0; i < syllabary_->size; ++i) {
@@ -589,6 +848,8 @@ bool Table::GetSyllabary(Syllabary* result) {
   return true;
 }
 string Table::GetSyllableById(SyllableId syllable_id) {
+  if (!syllabary_ && primary_)
+    return primary_->GetSyllableById(syllable_id);
   if (!syllabary_ ||
       syllable_id < 0 ||
       syllable_id >= static_cast<SyllableId>(syllabary_->size))
@@ -597,14 +858,14 @@ string Table::GetSyllableById(SyllableId syllable_id) {
 }
 
 TableAccessor Table::QueryWords(SyllableId syllable_id) {
-  TableQuery query(index_);
+  TableQuery query(index_, rank_index_);
   return query.Access(syllable_id);
 }
 
 TableAccessor Table::QueryPhrases(const Code& code) {
   if (code.empty())
     return TableAccessor();
-  TableQuery query(index_);
+  TableQuery query(index_, rank_index_);
   for (size_t i = 0; i < Code::kIndexCodeMaxLength; ++i) {
     if (code.size() == i + 1)
       return query.Access(code[i]);
@@ -621,13 +882,22 @@ bool Table::Query(const SyllableGraph& syll_graph, size_t start_pos,
       start_pos >= syll_graph.interpreted_length)
     return false;
   result->clear();
-  std::queue<pair<size_t, TableQuery>> q;
-  TableQuery initial_state(index_);
-  q.push({start_pos, initial_state});
-  while (!q.empty()) {
-    size_t current_pos = q.front().first;
-    TableQuery query(q.front().second);
-    q.pop();
+  // breadth-first search; the queue is kept for later queries on the same
+  // thread, and TableQuery states are plain values.
+  struct Step {
+    size_t pos;
+    TableQuery query;
+    // syllables taken to reach the query
+    SyllableStep path[kIndexCodeMaxLength];
+  };
+  static thread_local vector<Step> q;
+  q.clear();
+  q.push_back({start_pos, TableQuery(index_, rank_index_), {}});
+  for (size_t head = 0; head < q.size(); ++head) {
+    size_t current_pos = q[head].pos;
+    TableQuery query(q[head].query);
+    SyllableStep path[kIndexCodeMaxLength];
+    std::copy(q[head].path, q[head].path + query.level(), path);
     auto index = syll_graph.indices.find(current_pos);
     if (index == syll_graph.indices.end()) {
       continue;
@@ -635,21 +905,27 @@ bool Table::Query(const SyllableGraph& syll_graph, size_t start_pos,
     if (query.level() == Code::kIndexCodeMaxLength) {
       TableAccessor accessor(query.Access(-1));
       if (!accessor.exhausted()) {
-        (*result)[current_pos].push_back(accessor);
+        accessor.set_path(path);
+        result->Add(current_pos, accessor);
       }
       continue;
     }
+    SyllableStep& step = path[query.level()];
     for (const auto& spellings : index->second) {
       SyllableId syll_id = spellings.first;
       for (auto props : spellings.second) {
-        TableAccessor accessor(query.Access(syll_id, props->credibility));
         size_t end_pos = props->end_pos;
+        step.end_pos = static_cast<uint32_t>(end_pos);
+        step.is_correction = props->is_correction;
+        TableAccessor accessor(query.Access(syll_id, props->credibility));
         if (!accessor.exhausted()) {
-          (*result)[end_pos].push_back(accessor);
+          accessor.set_path(path);
+          result->Add(end_pos, accessor);
         }
         if (end_pos < syll_graph.interpreted_length &&
             query.Advance(syll_id, props->credibility)) {
-          q.push({end_pos, query});
+          q.push_back({end_pos, query, {}});
+          std::copy(path, path + query.level(), q.back().path);
           query.Backdate();
         }
       }
@@ -8,6 +8,7 @@
 #ifndef RIME_TABLE_H_
 #define RIME_TABLE_H_
 
+#include <algorithm>
 #include <cstring>
 #include <darts.h>
 #include <rime/common.h>
@@ -81,6 +82,43 @@ RIME_TABLE_UNION(PhraseIndex, Array<char>,
 
 using Index = HeadIndex;
 
+// v4.1 rank directories for O(1) lookup in trunk indices
+
+struct RankBlock {
+  // keys present in this block of 64 consecutive syllable ids
+  uint64_t bits;
+  // number of keys in preceding blocks
+  uint32_t rank;
+  uint32_t reserved;
+};
+
+struct TrunkRank {
+  SyllableId min_key;
+  // 0 if the trunk index has to be searched by key
+  uint32_t num_blocks;
+  OffsetPtr<RankBlock> blocks;
+  // rank directories of the next level trunk indices, one per node
+  OffsetPtr<OffsetPtr<TrunkRank>> children;
+};
+
+// rank directories of level 2 trunk indices, by level 1 syllable id
+using RankIndex = Array<OffsetPtr<TrunkRank>>;
+
+// v4.3 section types
+
+const uint32_t kSyllabarySection = SectionType('S', 'Y', 'L', 'B');
+const uint32_t kIndexSection = SectionType('I', 'N', 'D', 'X');
+const uint32_t kRankIndexSection = SectionType('R', 'A', 'N', 'K');
+const uint32_t kStringTableSection = SectionType('S', 'T', 'R', 'S');
+// packs use the syllabary of their primary table instead of their own
+const uint32_t kPackSection = SectionType('P', 'A', 'C', 'K');
+
+struct PackInfo {
+  uint32_t primary_checksum;
+  // entry texts with ids below this are in the primary table's string table
+  uint32_t num_shared_strings;
+};
+
 struct Metadata {
   static const int kFormatMaxLength = 32;
   char format[kFormatMaxLength];
@@ -90,8 +128,10 @@ struct Metadata {
   OffsetPtr<Syllabary> syllabary;
   OffsetPtr<Index> index;
   // v2
-  int32_t reserved_1;
-  int32_t reserved_2;
+  // v4.1; reserved and zero in earlier versions
+  OffsetPtr<RankIndex> rank_index;
+  // v4.3; reserved and zero in earlier versions
+  OffsetPtr<SectionDirectory> sections;
   OffsetPtr<char> string_table;
   uint32_t string_table_size;
 };
@@ -114,12 +154,23 @@ class TableAccessor {
   RIME_API size_t remaining() const;
   RIME_API const table::Entry* entry() const;
   RIME_API const table::Code* extra_code() const;
+  // remaining entries of a tail index, sorted by extra code since v4.2
+  const table::LongEntry* long_entries() const {
+    return long_entries_ ? long_entries_ + cursor_ : nullptr;
+  }
   const IndexCode& index_code() const { return index_code_; }
   Code code() const;
   double credibility() const { return credibility_; }
+  // syllables of the index code as found in the syllable graph, if the
+  // accessor is a result of Table::Query().
+  const SyllableStep* path() const { return path_; }
+  void set_path(const SyllableStep* path) {
+    std::copy(path, path + index_code_.size(), path_);
+  }
 
  private:
   IndexCode index_code_;
+  SyllableStep path_[kIndexCodeMaxLength];
   const table::Entry* entries_ = nullptr;
   const table::LongEntry* long_entries_ = nullptr;
   size_t size_ = 0;
@@ -127,7 +178,47 @@ class TableAccessor {
   double credibility_ = 0.0;
 };
 
-using TableQueryResult = map<int, vector<TableAccessor>>;
+// Accessors found by Table::Query, indexed by end position.
+// Clearing keeps the buffers for the next query.
+class TableQueryResult {
+ public:
+  using Accessors = vector<TableAccessor>;
+
+  void clear() {
+    for (auto& accessors : by_end_pos_) {
+      accessors.clear();
+    }
+    num_positions_ = 0;
+  }
+  bool empty() const { return num_positions_ == 0; }
+  // number of end positions having results
+  size_t size() const { return num_positions_; }
+  // one past the last end position that may have results
+  size_t end_pos_limit() const { return by_end_pos_.size(); }
+
+  bool has(size_t end_pos) const {
+    return end_pos < by_end_pos_.size() && !by_end_pos_[end_pos].empty();
+  }
+  Accessors& at(size_t end_pos) { return by_end_pos_.at(end_pos); }
+  const Accessors& at(size_t end_pos) const {
+    return by_end_pos_.at(end_pos);
+  }
+
+  void Add(size_t end_pos, const TableAccessor& accessor) {
+    if (end_pos >= by_end_pos_.size()) {
+      by_end_pos_.resize(end_pos + 1);
+    }
+    auto& accessors = by_end_pos_[end_pos];
+    if (accessors.empty()) {
+      ++num_positions_;
+    }
+    accessors.push_back(accessor);
+  }
+
+ private:
+  vector<Accessors> by_end_pos_;
+  size_t num_positions_ = 0;
+};
 
 struct SyllableGraph;
 class TableQuery;
@@ -143,6 +234,15 @@ class Table : public MappedFile {
                       const Vocabulary& vocabulary,
                       size_t num_entries,
                       uint32_t dict_file_checksum = 0);
+  // builds a pack referring to the syllabary of the loaded primary table,
+  // and optionally to the entry texts also found in the primary table.
+  RIME_API bool BuildPack(const an<Table>& primary,
+                          const Vocabulary& vocabulary,
+                          size_t num_entries,
+                          uint32_t dict_file_checksum,
+                          bool share_strings);
+  // packs can only be loaded after their primary table.
+  void set_primary_table(const an<Table>& primary) { primary_ = primary; }
 
   bool GetSyllabary(Syllabary* syllabary);
   RIME_API string GetSyllableById(int syllable_id);
@@ -154,8 +254,30 @@ class Table : public MappedFile {
   RIME_API string GetEntryText(const table::Entry& entry);
 
   uint32_t dict_file_checksum() const;
+  // checks the integrity of all sections, if the format has any.
+  RIME_API bool Verify();
+  // a section of the loaded table, or nullptr if there is none of the type.
+  const Section* FindSection(uint32_t type) const {
+    return MappedFile::FindSection(sections_, type);
+  }
+  // whether entries in tail indices are sorted by extra code
+  bool sorted_tail() const { return sorted_tail_; }
+
+  // number of decoded entry texts to cache; tables shared by several
+  // schemas keep the largest size requested. the size only applies the
+  // next time the table is loaded: a loaded table keeps the cache it was
+  // loaded with, which other threads may be reading without a lock.
+  RIME_API void set_string_cache_size(size_t size);
+  // decoded texts served from the string cache since the table was loaded.
+  size_t num_string_cache_hits() const {
+    return string_table_ ? string_table_->num_cache_hits() : 0;
+  }
 
  private:
+  bool BuildFile(const Syllabary* syllabary,
+                 const Vocabulary& vocabulary,
+                 size_t num_entries,
+                 uint32_t dict_file_checksum);
   table::Index* BuildIndex(const Vocabulary& vocabulary,
                            size_t num_syllables);
   table::HeadIndex* BuildHeadIndex(const Vocabulary& vocabulary,
@@ -164,6 +286,9 @@ class Table : public MappedFile {
                                      const Vocabulary& vocabulary);
   table::TailIndex* BuildTailIndex(const Code& prefix,
                                    const Vocabulary& vocabulary);
+  table::RankIndex* BuildRankIndex();
+  table::TrunkRank* BuildTrunkRank(table::TrunkIndex* trunk,
+                                   bool with_children);
   bool BuildPhraseIndex(Code code, const Vocabulary& vocabulary,
                         map<string, int>* index_data);
   Array<table::Entry>* BuildEntryArray(const DictEntryList& entries);
@@ -181,9 +306,17 @@ class Table : public MappedFile {
   table::Metadata* metadata_ = nullptr;
   table::Syllabary* syllabary_ = nullptr;
   table::Index* index_ = nullptr;
+  table::RankIndex* rank_index_ = nullptr;
+  SectionDirectory* sections_ = nullptr;
+  bool sorted_tail_ = false;
+  // for packs
+  an<Table> primary_;
+  uint32_t num_shared_strings_ = 0;
+  vector<StringId*> own_string_references_;
 
   the<StringTable> string_table_;
   the<StringTableBuilder> string_table_builder_;
+  size_t string_cache_size_ = 0;
 };
 
 }  // namespace rime
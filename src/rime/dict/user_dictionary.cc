@@ -27,6 +27,7 @@ struct DfsState {
   size_t depth_limit;
   TickCount present_tick;
   Code code;
+  SyllablePath path;
   vector<double> credibility;
   map<int, DictEntryList> query_result;
   an<DbAccessor> accessor;
@@ -69,6 +70,7 @@ void DfsState::RecruitEntry(size_t pos) {
                                            credibility.back());
   if (e) {
     e->code = code;
+    e->path = path;
     DLOG(INFO) << "add entry at pos " << pos;
     query_result[pos].push_back(e);
   }
@@ -221,6 +223,12 @@ void UserDictionary::DfsLookup(const SyllableGraph& syll_graph,
       }
       BOOST_SCOPE_EXIT_END
       size_t end_pos = props->end_pos;
+      state->path.push_back({static_cast<uint32_t>(end_pos),
+                             props->is_correction});
+      BOOST_SCOPE_EXIT( (&state) ) {
+        state->path.pop_back();
+      }
+      BOOST_SCOPE_EXIT_END
       DLOG(INFO) << "edge: [" << current_pos << ", " << end_pos << ")";
       if (prefix != state->key) {  // 'a b c |d ' > 'a b c \tabracadabra'
         DLOG(INFO) << "forward scanning for '" << prefix << "'.";
@@ -279,6 +287,41 @@ UserDictionary::Lookup(const SyllableGraph& syll_graph,
   return collect(&state.query_result);
 }
 
+void UserDictionary::LookupAll(const SyllableGraph& syll_graph,
+                               map<size_t, an<UserDictEntryCollector>>* results,
+                               size_t depth_limit,
+                               double initial_credibility) {
+  if (!table_ || !prism_ || !loaded())
+    return;
+  DfsState state;
+  state.depth_limit = depth_limit;
+  FetchTickCount();
+  state.present_tick = tick_ + 1;
+  state.accessor = db_->Query("");
+  for (const auto& x : syll_graph.edges) {
+    size_t start_pos = x.first;
+    if (start_pos >= syll_graph.interpreted_length)
+      break;
+    if (results->find(start_pos) != results->end())
+      continue;
+    auto& collector = (*results)[start_pos];
+    state.code.clear();
+    state.credibility.assign(1, initial_credibility);
+    state.query_result.clear();
+    state.key.clear();
+    state.value.clear();
+    state.accessor->Jump(" ");  // skip metadata
+    string prefix;
+    DfsLookup(syll_graph, start_pos, prefix, &state);
+    if (state.query_result.empty())
+      continue;
+    for (auto& v : state.query_result) {
+      v.second.Sort();
+    }
+    collector = collect(&state.query_result);
+  }
+}
+
 size_t UserDictionary::LookupWords(UserDictEntryIterator* result,
                                    const string& input,
                                    bool predictive,
@@ -64,6 +64,12 @@ class UserDictionary : public Class<UserDictionary, const Ticket&> {
                                     size_t start_pos,
                                     size_t depth_limit = 0,
                                     double initial_credibility = 0.0);
+  // looks up every start position of the syllable graph with one database
+  // cursor; start positions already present in results are skipped.
+  void LookupAll(const SyllableGraph& syllable_graph,
+                 map<size_t, an<UserDictEntryCollector>>* results,
+                 size_t depth_limit = 0,
+                 double initial_credibility = 0.0);
   size_t LookupWords(UserDictEntryIterator* result,
                      const string& input,
                      bool predictive,
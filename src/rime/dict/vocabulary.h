@@ -26,7 +26,7 @@ struct IndexCode: public std::array<SyllableId, kIndexCodeMaxLength> {
   void push_back(SyllableId syllable_id);
   size_t size() const;
 private:
-  size_t size_;
+  size_t size_ = 0;
 };
 
 class Code : public vector<SyllableId> {
@@ -34,7 +34,8 @@ class Code : public vector<SyllableId> {
   Code() = default;
   Code(const IndexCode& indexCode) {
     resize(indexCode.size());
-    std::copy(indexCode.cbegin(), indexCode.cend(), begin());
+    std::copy(indexCode.cbegin(), indexCode.cbegin() + indexCode.size(),
+              begin());
   };
   static const size_t kIndexCodeMaxLength = rime::kIndexCodeMaxLength;
 
@@ -46,7 +47,16 @@ class Code : public vector<SyllableId> {
   string ToString() const;
 };
 
-struct DictEntry {
+// a syllable taken along the syllable graph: where it ends in the input,
+// and whether its spelling is a correction.
+struct SyllableStep {
+  uint32_t end_pos = 0;
+  bool is_correction = false;
+};
+
+using SyllablePath = vector<SyllableStep>;
+
+struct DictEntry : ArenaObject {
   string text;
   string comment;
   string preedit;
@@ -54,6 +64,9 @@ struct DictEntry {
   int commit_count = 0;
   Code code;  // multi-syllable code from prism
   string custom_code;  // user defined code
+  // one step per syllable of code, if the entry is looked up in a syllable
+  // graph; empty otherwise.
+  SyllablePath path;
   int remaining_code_length = 0;
 
   DictEntry() = default;
@@ -5,6 +5,7 @@
 // 2011-04-24 GONG Chen <chen.sst@gmail.com>
 //
 #include <cctype>
+#include <sstream>
 #include <rime/common.h>
 #include <rime/composition.h>
 #include <rime/context.h>
@@ -38,6 +39,8 @@ class ConcreteEngine : public Engine {
   void InitializeOptions();
   void CalculateSegmentation(Segmentation* segments);
   void TranslateSegments(Segmentation* segments);
+  void StashMenus(const Segmentation& segments);
+  string MenuCacheKey(const Segmentation& segments, size_t index) const;
   void FormatText(string* text);
   void OnCommit(Context* ctx);
   void OnSelect(Context* ctx);
@@ -51,6 +54,11 @@ class ConcreteEngine : public Engine {
   vector<of<Filter>> filters_;
   vector<of<Formatter>> formatters_;
   vector<of<Processor>> post_processors_;
+  // menus of the previous composition, to be reused by unchanged segments.
+  hash_map<string, an<Menu>> menu_cache_;
+  // bumped whenever an option or property that may affect translation
+  // changes.
+  int options_serial_ = 0;
 };
 
 // implementations
@@ -121,6 +129,7 @@ void ConcreteEngine::OnContextUpdate(Context* ctx) {
 void ConcreteEngine::OnOptionUpdate(Context* ctx, const string& option) {
   if (!ctx) return;
   LOG(INFO) << "updated option: " << option;
+  ++options_serial_;
   // apply new option to active segment
   if (ctx->IsComposing()) {
     ctx->RefreshNonConfirmedComposition();
@@ -134,6 +143,7 @@ void ConcreteEngine::OnOptionUpdate(Context* ctx, const string& option) {
 void ConcreteEngine::OnPropertyUpdate(Context* ctx, const string& property) {
   if (!ctx) return;
   LOG(INFO) << "updated property: " << property;
+  ++options_serial_;
   // notification
   string value = ctx->get_property(property);
   string msg(property + "=" + value);
@@ -145,6 +155,7 @@ void ConcreteEngine::Compose(Context* ctx) {
   Composition& comp = ctx->composition();
   const string active_input = ctx->input().substr(0, ctx->caret_pos());
   DLOG(INFO) << "active input: " << active_input;
+  StashMenus(comp);
   comp.Reset(active_input);
   if (ctx->caret_pos() < ctx->input().length() &&
       ctx->caret_pos() == comp.GetConfirmedPosition()) {
@@ -153,9 +164,42 @@ void ConcreteEngine::Compose(Context* ctx) {
   }
   CalculateSegmentation(&comp);
   TranslateSegments(&comp);
+  menu_cache_.clear();
   DLOG(INFO) << "composition: " << comp.GetDebugText();
 }
 
+void ConcreteEngine::StashMenus(const Segmentation& segments) {
+  menu_cache_.clear();
+  for (size_t i = 0; i < segments.size(); ++i) {
+    const Segment& segment = segments[i];
+    // selected segments may have been shortened by a partial selection.
+    // menus whose background work was cancelled are translated again.
+    if (segment.status == Segment::kGuess && segment.menu &&
+        !segment.menu->cancelled()) {
+      menu_cache_[MenuCacheKey(segments, i)] = segment.menu;
+    }
+  }
+}
+
+// A segment can reuse a previous menu only if its range, its input up to
+// the segment end, its tags, the selections before it (which determine the
+// preceding text) and the options are all the same. The segment containing
+// a changed tail therefore never matches.
+string ConcreteEngine::MenuCacheKey(const Segmentation& segments,
+                                    size_t index) const {
+  const Segment& segment = segments[index];
+  std::ostringstream key;
+  key << options_serial_ << '|' << segment.start << '|' << segment.end << '|'
+      << segments.input().substr(0, segment.end) << '|';
+  for (const string& tag : segment.tags) {
+    key << tag << ',';
+  }
+  for (size_t i = 0; i < index; ++i) {
+    key << '|' << segments[i].end << ':' << segments[i].selected_index;
+  }
+  return key.str();
+}
+
 void ConcreteEngine::CalculateSegmentation(Segmentation* segments) {
   while (!segments->HasFinishedSegmentation()) {
     size_t start_pos = segments->GetCurrentStartPosition();
@@ -186,15 +230,33 @@ void ConcreteEngine::CalculateSegmentation(Segmentation* segments) {
 }
 
 void ConcreteEngine::TranslateSegments(Segmentation* segments) {
-  for (Segment& segment : *segments) {
-    if (segment.status >= Segment::kGuess)
+  for (size_t i = 0; i < segments->size(); ++i) {
+    Segment& segment = (*segments)[i];
+    // a kept segment whose background work was cancelled is translated
+    // again.
+    bool stale = segment.status == Segment::kGuess && segment.menu &&
+        segment.menu->cancelled();
+    if (segment.status >= Segment::kGuess && !stale)
       continue;
     size_t len = segment.end - segment.start;
     if (len == 0)
       continue;
+    if (!menu_cache_.empty()) {
+      auto found = menu_cache_.find(MenuCacheKey(*segments, i));
+      if (found != menu_cache_.end() && !found->second->cancelled()) {
+        DLOG(INFO) << "reusing menu for segment [" << segment.start << ", "
+                   << segment.end << ")";
+        segment.status = Segment::kGuess;
+        segment.menu = found->second;
+        segment.selected_index = 0;
+        menu_cache_.erase(found);
+        continue;
+      }
+    }
     string input = segments->input().substr(segment.start, len);
     DLOG(INFO) << "translating segment: " << input;
     auto menu = New<Menu>();
+    Arena::Scope scope(menu->arena());
     for (auto& translator : translators_) {
       auto translation = translator->Query(input, segment);
       if (!translation)
@@ -233,6 +295,8 @@ void ConcreteEngine::CommitText(string text) {
 }
 
 void ConcreteEngine::OnCommit(Context* ctx) {
+  // translations may depend on the commit history and user dictionary.
+  menu_cache_.clear();
   context_->commit_history().Push(ctx->composition(), ctx->input());
   string text = ctx->GetCommitText();
   FormatText(&text);
@@ -270,6 +334,7 @@ void ConcreteEngine::OnSelect(Context* ctx) {
 void ConcreteEngine::ApplySchema(Schema* schema) {
   if (!schema)
     return;
+  menu_cache_.clear();
   schema_.reset(schema);
   context_->Clear();
   context_->ClearTransientOptions();
@@ -19,6 +19,7 @@
 #include <rime/gear/key_binder.h>
 #include <rime/gear/matcher.h>
 #include <rime/gear/navigator.h>
+#include <rime/gear/ngram_grammar.h>
 #include <rime/gear/punctuator.h>
 #include <rime/gear/recognizer.h>
 #include <rime/gear/reverse_lookup_filter.h>
@@ -88,6 +89,11 @@ static void rime_gears_initialize() {
 
   // formatters
   r.Register("shape_formatter", new Component<ShapeFormatter>);
+
+  // grammar
+  if (!r.Find("grammar")) {  // allow grammar plugins
+    r.Register("grammar", new NgramGrammarComponent);
+  }
 }
 
 static void rime_gears_finalize() {
@@ -14,6 +14,8 @@ class Grammar : public Class<Grammar, Config*> {
   virtual double Query(const string& context,
                        const string& word,
                        bool is_rear) = 0;
+  // whether Query() may be called from several threads at once.
+  virtual bool thread_safe() const { return false; }
 
   inline static double Evaluate(const string& context,
                                 const string& entry_text,
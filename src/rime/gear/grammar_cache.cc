@@ -0,0 +1,56 @@
+//
+// Copyright RIME Developers
+// Distributed under the BSD License
+//
+#include <rime/algo/utilities.h>
+#include <rime/gear/grammar_cache.h>
+
+namespace rime {
+
+const size_t GrammarCache::kNumSlots;
+const size_t GrammarCache::kNumLocks;
+
+GrammarCache::GrammarCache(the<Grammar> grammar)
+    : grammar_(std::move(grammar)), slots_(kNumSlots) {}
+
+GrammarCache::~GrammarCache() {
+  if (num_queries_ > 0) {
+    LOG(INFO) << "grammar cache: " << num_hits_ << " hits in "
+              << num_queries_ << " queries (" << hit_rate() * 100 << "%).";
+  }
+}
+
+double GrammarCache::Query(const string& context,
+                           const string& word,
+                           bool is_rear) {
+  uint64_t context_hash = HashText(context);
+  uint64_t word_hash = HashText(word);
+  size_t index = (context_hash ^ (word_hash * 31) ^ is_rear) % kNumSlots;
+  std::mutex& mutex = mutexes_[index % kNumLocks];
+  ++num_queries_;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    const Slot& slot = slots_[index];
+    if (slot.occupied &&
+        slot.context_hash == context_hash &&
+        slot.word_hash == word_hash &&
+        slot.is_rear == is_rear) {
+      ++num_hits_;
+      return slot.value;
+    }
+  }
+  // the slot is not locked while querying the grammar, which can be slow.
+  double value;
+  if (grammar_->thread_safe()) {
+    value = grammar_->Query(context, word, is_rear);
+  }
+  else {
+    std::lock_guard<std::mutex> lock(grammar_mutex_);
+    value = grammar_->Query(context, word, is_rear);
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  slots_[index] = {context_hash, word_hash, is_rear, true, value};
+  return value;
+}
+
+}  // namespace rime
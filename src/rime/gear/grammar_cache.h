@@ -0,0 +1,62 @@
+//
+// Copyright RIME Developers
+// Distributed under the BSD License
+//
+#ifndef RIME_GRAMMAR_CACHE_H_
+#define RIME_GRAMMAR_CACHE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <rime/common.h>
+#include <rime/gear/grammar.h>
+
+namespace rime {
+
+// memoizes queries to any grammar component, as the same pairs of context
+// and word recur in sentence making and contextual suggestions.
+// it can be queried from several threads, such as the workers of async
+// compose and the front end; queries to a grammar that is not thread-safe
+// are passed on one at a time.
+class GrammarCache : public Grammar {
+ public:
+  static constexpr size_t kNumSlots = 1 << 12;
+  // slots are locked in stripes, for queries from a pool of threads.
+  static constexpr size_t kNumLocks = 64;
+
+  explicit GrammarCache(the<Grammar> grammar);
+  ~GrammarCache() override;
+
+  double Query(const string& context,
+               const string& word,
+               bool is_rear) override;
+  // the slots are locked; queries are passed on to the wrapped grammar.
+  bool thread_safe() const override { return grammar_->thread_safe(); }
+
+  size_t num_queries() const { return num_queries_; }
+  size_t num_hits() const { return num_hits_; }
+  double hit_rate() const {
+    return num_queries_ ? double(num_hits_) / num_queries_ : 0.0;
+  }
+
+ private:
+  struct Slot {
+    uint64_t context_hash = 0;
+    uint64_t word_hash = 0;
+    bool is_rear = false;
+    bool occupied = false;
+    double value = 0.0;
+  };
+
+  the<Grammar> grammar_;
+  // held while querying the grammar, unless it is thread-safe
+  std::mutex grammar_mutex_;
+  vector<Slot> slots_;
+  std::mutex mutexes_[kNumLocks];
+  std::atomic<size_t> num_queries_{0};
+  std::atomic<size_t> num_hits_{0};
+};
+
+}  // namespace rime
+
+#endif  // RIME_GRAMMAR_CACHE_H_
@@ -0,0 +1,68 @@
+//
+// Copyright RIME Developers
+// Distributed under the BSD License
+//
+#include <rime/config.h>
+#include <rime/resource.h>
+#include <rime/service.h>
+#include <rime/dict/ngram_model.h>
+#include <rime/gear/ngram_grammar.h>
+
+namespace rime {
+
+NgramGrammar::NgramGrammar(Config* config, an<NgramModel> model)
+    : model_(std::move(model)) {
+  if (!config)
+    return;
+  config->GetInt("grammar/collocation_max_length", &collocation_max_length_);
+  config->GetInt("grammar/collocation_min_length", &collocation_min_length_);
+  config->GetDouble("grammar/collocation_penalty", &collocation_penalty_);
+  config->GetDouble("grammar/non_collocation_penalty",
+                    &non_collocation_penalty_);
+  config->GetDouble("grammar/rear_penalty", &rear_penalty_);
+}
+
+double NgramGrammar::Query(const string& context,
+                           const string& word,
+                           bool is_rear) {
+  double score = 0.0;
+  double result = model_->Query(context, word,
+                                (std::max)(collocation_min_length_, 1),
+                                (std::max)(collocation_max_length_, 0),
+                                &score) ?
+      collocation_penalty_ + score : non_collocation_penalty_;
+  return is_rear ? result + rear_penalty_ : result;
+}
+
+static const ResourceType kNgramModelResourceType = {
+  "ngram_model", "", ".ngram.bin"
+};
+
+NgramGrammarComponent::NgramGrammarComponent()
+    : resource_resolver_(
+          Service::instance().CreateDeployedResourceResolver(
+              kNgramModelResourceType)) {}
+
+NgramGrammarComponent::~NgramGrammarComponent() {
+}
+
+Grammar* NgramGrammarComponent::Create(Config* config) {
+  string language;
+  if (!config || !config->GetString("grammar/language", &language) ||
+      language.empty()) {
+    return nullptr;
+  }
+  auto model = model_map_[language].lock();
+  if (!model) {
+    auto file_path = resource_resolver_->ResolvePath(language).string();
+    model = New<NgramModel>(file_path);
+    if (!model->Exists() || !model->Load()) {
+      LOG(WARNING) << "n-gram model for '" << language << "' is unavailable.";
+      return nullptr;
+    }
+    model_map_[language] = model;
+  }
+  return new NgramGrammar(config, model);
+}
+
+}  // namespace rime
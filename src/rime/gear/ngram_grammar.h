@@ -0,0 +1,58 @@
+//
+// Copyright RIME Developers
+// Distributed under the BSD License
+//
+#ifndef RIME_NGRAM_GRAMMAR_H_
+#define RIME_NGRAM_GRAMMAR_H_
+
+#include <rime/common.h>
+#include <rime/gear/grammar.h>
+
+namespace rime {
+
+class NgramModel;
+class ResourceResolver;
+
+// scores words by an n-gram model deployed as <language>.ngram.bin.
+//
+// grammar:
+//   language: <model name>
+//   collocation_max_length: 4  # of the context, in characters
+//   collocation_min_length: 1
+//   collocation_penalty: -4    # added to the log probability of a match
+//   non_collocation_penalty: -12
+//   rear_penalty: 0            # added to the words at the end of input
+class NgramGrammar : public Grammar {
+ public:
+  NgramGrammar(Config* config, an<NgramModel> model);
+
+  double Query(const string& context,
+               const string& word,
+               bool is_rear) override;
+  // the model is read-only once loaded.
+  bool thread_safe() const override { return true; }
+
+ private:
+  an<NgramModel> model_;
+  int collocation_max_length_ = 4;
+  int collocation_min_length_ = 1;
+  double collocation_penalty_ = -4;
+  double non_collocation_penalty_ = -12;
+  double rear_penalty_ = 0;
+};
+
+class NgramGrammarComponent : public Grammar::Component {
+ public:
+  NgramGrammarComponent();
+  ~NgramGrammarComponent() override;
+
+  Grammar* Create(Config* config) override;
+
+ private:
+  map<string, weak<NgramModel>> model_map_;
+  the<ResourceResolver> resource_resolver_;
+};
+
+}  // namespace rime
+
+#endif  // RIME_NGRAM_GRAMMAR_H_
@@ -7,11 +7,18 @@
 // 2011-10-06 GONG Chen <chen.sst@gmail.com>
 //
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <limits>
+#include <thread>
 #include <rime/candidate.h>
 #include <rime/config.h>
 #include <rime/dict/vocabulary.h>
 #include <rime/gear/grammar.h>
+#include <rime/gear/grammar_cache.h>
 #include <rime/gear/poet.h>
 
 namespace rime {
@@ -20,15 +27,30 @@ namespace rime {
 // the output line of the algorithm is transformed to an<Sentence>.
 struct Line {
   // be sure the pointer to predecessor Line object is stable. it works since
-  // pointer to values stored in std::map and std::unordered_map are stable.
+  // pointer to values stored in std::map and std::deque (added at the end)
+  // are stable.
   const Line* predecessor;
   // as long as the word graph lives, pointers to entries are valid.
   const DictEntry* entry;
   size_t end_pos;
   double weight;
+  // interned text of the last word; 0 for none.
+  int word_id;
+  // cumulative stats, so that lines compare in constant time
+  int word_count;
+  // hash of the word lengths in order
+  uint64_t length_signature;
 
   static const Line kEmpty;
 
+  // the line extended with a word
+  Line Extend(const DictEntry* entry, int word_id,
+              size_t end_pos, double weight) const {
+    const uint64_t kPrime = 1099511628211ULL;
+    return Line{this, entry, end_pos, weight, word_id, word_count + 1,
+                (length_signature ^ (end_pos - this->end_pos)) * kPrime};
+  }
+
   bool empty() const {
     return !predecessor && !entry;
   }
@@ -61,22 +83,329 @@ struct Line {
         predecessor->last_word() + last_word();
   }
 
-  vector<size_t> word_lengths() const {
-    vector<size_t> lengths;
-    size_t last_end_pos = 0;
-    for (const auto* c : components()) {
-      lengths.push_back(c->end_pos - last_end_pos);
-      last_end_pos = c->end_pos;
+  size_t last_word_length() const {
+    return predecessor ? end_pos - predecessor->end_pos : 0;
+  }
+};
+
+const Line Line::kEmpty{nullptr, nullptr, 0, 0.0, 0, 0,
+                        14695981039346656037ULL};
+
+// whether the word lengths of one line are lexicographically less than
+// those of the other line, of as many words; compared from the last words
+// back to the first, until the lines share the preceding words.
+static bool word_lengths_less(const Line& one, const Line& other) {
+  bool less = false;
+  for (const Line *a = &one, *b = &other;
+       a != b && !a->empty() && !b->empty();
+       a = a->predecessor, b = b->predecessor) {
+    size_t a_length = a->last_word_length();
+    size_t b_length = b->last_word_length();
+    if (a_length != b_length) {
+      less = a_length < b_length;
     }
-    return lengths;
   }
+  return less;
+}
+
+class PoetSession {
+ public:
+  virtual ~PoetSession() = default;
 };
 
-const Line Line::kEmpty{nullptr, nullptr, 0, 0.0};
+static bool same_entries(const DictEntryList& one,
+                         const DictEntryList& other) {
+  return one.size() == other.size() &&
+      std::equal(one.begin(), one.end(), other.begin(),
+                 [](const an<DictEntry>& a, const an<DictEntry>& b) {
+                   return a->text == b->text &&
+                       a->weight == b->weight &&
+                       a->code == b->code;
+                 });
+}
+
+// the word graph and states of sentence making, kept across keystrokes.
+// states at positions up to where the word graph has changed are reused.
+template <class Strategy>
+class StrategySession : public PoetSession {
+ public:
+  // shared with the sentences yet to be made from it
+  an<WordGraph> graph = New<WordGraph>();
+  map<int, typename Strategy::State> states;
+
+  // returns the last position with a valid state; edges ending there or
+  // before need not be evaluated again. states keep up to max_alternatives
+  // of the best lines to them.
+  int Resume(const WordGraph& new_graph,
+             size_t new_total_length,
+             const string& new_preceding_text,
+             size_t max_alternatives);
+
+  // positions where the best line has been committed, in order.
+  vector<int> commits;
+  // where the search has been degraded to meet the latency ceiling; the
+  // states after it are evaluated again on the next keystroke.
+  int degraded_pos = (std::numeric_limits<int>::max)();
+  // interned texts of the entries on each edge to evaluate, in order.
+  map<int, map<int, vector<int>>> word_ids;
+
+ private:
+  int Intern(const string& text) {
+    return interned_.emplace(text, static_cast<int>(interned_.size()))
+        .first->second;
+  }
+
+  static constexpr size_t kMinInternedTexts = 256;
+
+  size_t total_length_ = 0;
+  string preceding_text_;
+  // the fewest alternatives kept by any of the states
+  size_t max_alternatives_ = 0;
+  // the empty text has id 0, as the line at the beginning.
+  hash_map<string, int> interned_{{string(), 0}};
+};
+
+// returns the first end position where an edge is added, removed or has
+// different entries in the new word graph.
+static int first_changed_end_pos(const WordGraph& graph,
+                                 const WordGraph& new_graph) {
+  int changed = (std::numeric_limits<int>::max)();
+  auto compare_edges = [&changed](const map<int, DictEntryList>& edges,
+                                  const map<int, DictEntryList>* other,
+                                  bool compare_entries) {
+    for (const auto& ev : edges) {
+      if (ev.first >= changed)
+        break;
+      auto found = other ? other->find(ev.first) : edges.end();
+      if (!other || found == other->end() ||
+          (compare_entries && !same_entries(ev.second, found->second))) {
+        changed = ev.first;
+        break;
+      }
+    }
+  };
+  for (const auto& sv : graph) {
+    auto found = new_graph.find(sv.first);
+    compare_edges(sv.second,
+                  found != new_graph.end() ? &found->second : nullptr,
+                  true);
+  }
+  // look for edges added to the new graph
+  for (const auto& sv : new_graph) {
+    auto found = graph.find(sv.first);
+    compare_edges(sv.second,
+                  found != graph.end() ? &found->second : nullptr,
+                  false);
+  }
+  return changed;
+}
+
+template <class Strategy>
+int StrategySession<Strategy>::Resume(const WordGraph& new_graph,
+                                      size_t new_total_length,
+                                      const string& new_preceding_text,
+                                      size_t max_alternatives) {
+  int valid_pos = 0;
+  if (!states.empty() && new_preceding_text == preceding_text_ &&
+      max_alternatives <= max_alternatives_) {
+    // the state at a position depends on the edges ending there or before.
+    valid_pos = first_changed_end_pos(*graph, new_graph) - 1;
+    // edges to the end of input are evaluated as such
+    if (new_total_length != total_length_) {
+      int end_pos = (std::min)(new_total_length, total_length_);
+      valid_pos = (std::min)(valid_pos, end_pos - 1);
+    }
+    valid_pos = (std::min)(valid_pos, degraded_pos);
+    valid_pos = (std::max)(valid_pos, 0);
+  }
+  // texts of words no longer in the graph are interned as long as the
+  // states are resumed; start over when they outnumber those in the graph.
+  if (valid_pos > 0) {
+    size_t num_entries = 0;
+    for (const auto& sv : new_graph) {
+      for (const auto& ev : sv.second) {
+        num_entries += ev.second.size();
+      }
+    }
+    if (interned_.size() > 2 * num_entries + kMinInternedTexts) {
+      valid_pos = 0;
+    }
+  }
+  degraded_pos = (std::numeric_limits<int>::max)();
+  while (!commits.empty() && commits.back() > valid_pos) {
+    commits.pop_back();
+  }
+  auto merged_graph = New<WordGraph>(new_graph);
+  if (valid_pos == 0) {
+    states.clear();
+    Strategy::Initiate(states[0]);
+    interned_.clear();
+    Intern(string());
+  }
+  else {
+    states.erase(states.upper_bound(valid_pos), states.end());
+    // lines in the kept states point to entries of the previous word graph.
+    for (auto& sv : *merged_graph) {
+      if (sv.first >= valid_pos)
+        break;
+      const auto& edges = (*graph)[sv.first];
+      for (auto& ev : sv.second) {
+        if (ev.first > valid_pos)
+          break;
+        ev.second = edges.at(ev.first);
+      }
+    }
+    DLOG(INFO) << "resumed sentence making after pos " << valid_pos;
+  }
+  {
+    // the session keeps entries across keystrokes; copy them out of the
+    // arena of the menu they were looked up for, so that they do not keep
+    // the arenas of earlier menus alive. kept edges are copies already.
+    Arena::Scope no_arena(nullptr);
+    for (auto& sv : *merged_graph) {
+      for (auto& ev : sv.second) {
+        if (ev.first <= valid_pos)
+          continue;
+        for (auto& entry : ev.second) {
+          entry = New<DictEntry>(*entry);
+        }
+      }
+    }
+  }
+  graph = std::move(merged_graph);
+  word_ids.clear();
+  for (const auto& sv : *graph) {
+    auto& ids_from_start = word_ids[sv.first];
+    for (const auto& ev : sv.second) {
+      auto& ids = ids_from_start[ev.first];
+      if (!Strategy::kKeyedByWord || ev.first <= valid_pos)
+        continue;  // not to be evaluated
+      ids.reserve(ev.second.size());
+      for (const auto& entry : ev.second) {
+        ids.push_back(Intern(entry->text));
+      }
+    }
+  }
+  total_length_ = new_total_length;
+  preceding_text_ = new_preceding_text;
+  max_alternatives_ = valid_pos == 0 ?
+      max_alternatives : (std::min)(max_alternatives_, max_alternatives);
+  return valid_pos;
+}
+
+// positions in the word graph from which the end of input can be reached.
+static set<int> positions_reaching(const WordGraph& graph, int end_pos) {
+  set<int> reaching{end_pos};
+  for (auto sv = graph.rbegin(); sv != graph.rend(); ++sv) {
+    for (const auto& ev : sv->second) {
+      if (!ev.second.empty() && reaching.count(ev.first)) {
+        reaching.insert(sv->first);
+        break;
+      }
+    }
+  }
+  return reaching;
+}
+
+// runs batches of tasks on a few threads, along with the calling thread.
+class ScoringPool {
+ public:
+  explicit ScoringPool(size_t num_threads);
+  ~ScoringPool();
+
+  // runs task(0) to task(num_tasks - 1) in any order and on any thread;
+  // returns when all are done.
+  void Run(size_t num_tasks, const function<void (size_t)>& task);
+
+  size_t num_threads() const { return threads_.size() + 1; }
+
+ private:
+  void Work();
+  void RunTasks();
+
+  vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable work_ready_;
+  std::condition_variable work_done_;
+  // the current batch, which does not change until all workers are done.
+  const function<void (size_t)>* task_ = nullptr;
+  size_t num_tasks_ = 0;
+  std::atomic<size_t> next_task_{0};
+  uint64_t batch_ = 0;
+  size_t num_pending_workers_ = 0;
+  bool stopping_ = false;
+};
+
+ScoringPool::ScoringPool(size_t num_threads) {
+  for (size_t i = 1; i < num_threads; ++i) {
+    threads_.emplace_back(&ScoringPool::Work, this);
+  }
+}
+
+ScoringPool::~ScoringPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_ready_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ScoringPool::Run(size_t num_tasks,
+                      const function<void (size_t)>& task) {
+  if (threads_.empty() || num_tasks < 2) {
+    for (size_t i = 0; i < num_tasks; ++i) {
+      task(i);
+    }
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_ = &task;
+    num_tasks_ = num_tasks;
+    next_task_ = 0;
+    num_pending_workers_ = threads_.size();
+    ++batch_;
+  }
+  work_ready_.notify_all();
+  RunTasks();
+  std::unique_lock<std::mutex> lock(mutex_);
+  work_done_.wait(lock, [this] { return num_pending_workers_ == 0; });
+  task_ = nullptr;
+}
+
+void ScoringPool::Work() {
+  uint64_t last_batch = 0;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    work_ready_.wait(lock, [this, last_batch] {
+      return stopping_ || batch_ != last_batch;
+    });
+    if (stopping_)
+      return;
+    last_batch = batch_;
+    lock.unlock();
+    RunTasks();
+    lock.lock();
+    if (--num_pending_workers_ == 0) {
+      work_done_.notify_one();
+    }
+  }
+}
+
+void ScoringPool::RunTasks() {
+  for (size_t i; (i = next_task_++) < num_tasks_; ) {
+    (*task_)(i);
+  }
+}
 
 inline static Grammar* create_grammar(Config* config) {
-  if (auto* grammar = Grammar::Require("grammar")) {
-    return grammar->Create(config);
+  if (auto* component = Grammar::Require("grammar")) {
+    if (auto* grammar = component->Create(config)) {
+      return new GrammarCache(the<Grammar>(grammar));
+    }
   }
   return nullptr;
 }
@@ -84,7 +413,17 @@ inline static Grammar* create_grammar(Config* config) {
 Poet::Poet(const Language* language, Config* config, Compare compare)
     : language_(language),
       grammar_(create_grammar(config)),
-      compare_(compare) {}
+      compare_(compare) {
+  if (config) {
+    config->GetInt("poet/beam_width", &beam_width_);
+    config->GetInt("poet/max_entries_per_edge", &max_entries_per_edge_);
+    config->GetInt("poet/window_size", &window_size_);
+    config->GetInt("poet/latency_ceiling", &latency_ceiling_);
+    config->GetBool("poet/parallel", &parallel_);
+    config->GetInt("poet/parallel_min_length", &parallel_min_length_);
+    config->GetInt("poet/parallel_threads", &parallel_threads_);
+  }
+}
 
 Poet::~Poet() {}
 
@@ -96,165 +435,657 @@ bool Poet::CompareWeight(const Line& one, const Line& other) {
 bool Poet::LeftAssociateCompare(const Line& one, const Line& other) {
   if (one.weight < other.weight) return true;
   if (one.weight == other.weight) {
-    auto one_word_lens = one.word_lengths();
-    auto other_word_lens = other.word_lengths();
     // less words is more favorable
-    if (one_word_lens.size() > other_word_lens.size()) return true;
-    if (one_word_lens.size() == other_word_lens.size()) {
-      return std::lexicographical_compare(
-          one_word_lens.begin(), one_word_lens.end(),
-          other_word_lens.begin(), other_word_lens.end());
+    if (one.word_count > other.word_count) return true;
+    if (one.word_count == other.word_count &&
+        one.length_signature != other.length_signature) {
+      return word_lengths_less(one, other);
     }
   }
   return false;
 }
 
-// keep the best line candidate per last phrase
-using LineCandidates = hash_map<string, Line>;
+// the comparisons known to the poet, to be inlined in the search.
+struct WeightOrder {
+  bool operator() (const Line& one, const Line& other) const {
+    return Poet::CompareWeight(one, other);
+  }
+};
+
+struct LeftAssociateOrder {
+  bool operator() (const Line& one, const Line& other) const {
+    return Poet::LeftAssociateCompare(one, other);
+  }
+};
+
+// the best line found to a state. if more sentences than one are to be
+// made, also the best lines found to it, best first, the first being the
+// same as the best line.
+struct LineNode {
+  Line best;
+  vector<Line> alternatives;
+
+  bool empty() const { return best.empty(); }
 
-template <int N>
-static vector<const Line*> find_top_candidates(
-    const LineCandidates& candidates, Poet::Compare compare) {
-  vector<const Line*> top;
-  top.reserve(N + 1);
-  for (const auto& candidate : candidates) {
+  template <class Compare>
+  void Update(const Line& new_line, Compare compare,
+              size_t max_alternatives) {
+    if (best.empty() || compare(best, new_line)) {
+      DLOG(INFO) << "updated line ending at " << new_line.end_pos
+                 << " with text: ..." << new_line.last_word()
+                 << " weight: " << new_line.weight;
+      best = new_line;
+    }
+    if (max_alternatives < 2)
+      return;
+    // desc; of lines comparing equal, the one found first comes first.
     auto pos = std::upper_bound(
-        top.begin(), top.end(), &candidate.second,
-        [&](const Line* a, const Line* b) { return compare(*b, *a); }); // desc
-    if (pos - top.begin() >= N) continue;
-    top.insert(pos, &candidate.second);
-    if (top.size() > N) top.pop_back();
+        alternatives.begin(), alternatives.end(), new_line,
+        [&](const Line& a, const Line& b) { return compare(b, a); });
+    if (static_cast<size_t>(pos - alternatives.begin()) >= max_alternatives)
+      return;
+    alternatives.insert(pos, new_line);
+    if (alternatives.size() > max_alternatives)
+      alternatives.pop_back();
   }
-  return top;
-}
+};
+
+// keep the best line candidate per last phrase, by interned text. lines are
+// visited in the order they are added, so that of lines comparing equal,
+// the one found first is taken, whatever the ids of their texts.
+class LineCandidates {
+ public:
+  LineNode& operator[] (int word_id) {
+    auto found = index_.emplace(word_id, nodes_.size());
+    if (found.second)
+      nodes_.emplace_back();
+    return nodes_[found.first->second];
+  }
+
+  void clear() {
+    index_.clear();
+    nodes_.clear();
+  }
+
+  bool empty() const { return nodes_.empty(); }
+  size_t size() const { return nodes_.size(); }
+  std::deque<LineNode>::const_iterator begin() const { return nodes_.begin(); }
+  std::deque<LineNode>::const_iterator end() const { return nodes_.end(); }
+
+ private:
+  hash_map<int, size_t> index_;
+  std::deque<LineNode> nodes_;
+};
 
-using UpdateLineCandidate = function<void (const Line& candidate)>;
+// the best of up to N lines, best first. of lines comparing equal, the one
+// added first comes first.
+template <size_t N>
+class TopLines {
+ public:
+  explicit TopLines(size_t limit) : limit_((std::min)(limit, N)) {}
+
+  template <class Compare>
+  void Add(const Line* line, Compare compare) {
+    // desc
+    auto pos = std::upper_bound(
+        lines_, lines_ + size_, line,
+        [&](const Line* a, const Line* b) { return compare(*b, *a); });
+    size_t index = pos - lines_;
+    if (index >= limit_)
+      return;
+    if (size_ < limit_)
+      ++size_;
+    std::copy_backward(lines_ + index, lines_ + size_ - 1, lines_ + size_);
+    lines_[index] = line;
+  }
+
+  const Line* const* begin() const { return lines_; }
+  const Line* const* end() const { return lines_ + size_; }
+
+ private:
+  size_t limit_;
+  size_t size_ = 0;
+  const Line* lines_[N];
+};
 
 struct BeamSearch {
   using State = LineCandidates;
+  static constexpr bool kKeyedByWord = true;
 
   static constexpr int kMaxLineCandidates = 7;
 
   static void Initiate(State& initial_state) {
-    initial_state.emplace("", Line::kEmpty);
+    initial_state[0].best = Line::kEmpty;
   }
 
+  template <class Compare, class Update>
   static void ForEachCandidate(const State& state,
-                               Poet::Compare compare,
-                               UpdateLineCandidate update) {
-    auto top_candidates =
-        find_top_candidates<kMaxLineCandidates>(state, compare);
+                               Compare compare,
+                               size_t beam_width,
+                               Update update) {
+    TopLines<kMaxLineCandidates> top_candidates(beam_width);
+    for (const auto& candidate : state) {
+      top_candidates.Add(&candidate.best, compare);
+    }
     for (const auto* candidate : top_candidates) {
       update(*candidate);
     }
   }
 
-  static Line& BestLineToUpdate(State& state, const Line& new_line) {
-    const auto& key = new_line.last_word();
-    return state[key];
+  // keeps only the best line in the state. no line is extended from the
+  // state yet, so that the lines may move.
+  template <class Compare>
+  static void Commit(State& state, Compare compare) {
+    const LineNode* best = nullptr;
+    for (const auto& candidate : state) {
+      if (!best || compare(best->best, candidate.best)) {
+        best = &candidate;
+      }
+    }
+    if (!best)
+      return;
+    LineNode kept = *best;
+    state.clear();
+    state[kept.best.word_id] = std::move(kept);
   }
 
-  static const Line& BestLineInState(const State& final_state,
-                                     Poet::Compare compare) {
-    const Line* best = nullptr;
-    for (const auto& candidate : final_state) {
-      if (!best || compare(*best, candidate.second)) {
-        best = &candidate.second;
-      }
+  static LineNode& NodeToUpdate(State& state, const Line& new_line) {
+    return state[new_line.word_id];
+  }
+
+  template <class Visit>
+  static void ForEachNode(const State& state, Visit visit) {
+    for (const auto& node : state) {
+      visit(node);
     }
-    return best ? *best : Line::kEmpty;
   }
 };
 
 struct DynamicProgramming {
-  using State = Line;
+  using State = LineNode;
+  static constexpr bool kKeyedByWord = false;
 
   static void Initiate(State& initial_state) {
-    initial_state = Line::kEmpty;
+    initial_state.best = Line::kEmpty;
   }
 
+  template <class Compare, class Update>
   static void ForEachCandidate(const State& state,
-                               Poet::Compare compare,
-                               UpdateLineCandidate update) {
-    update(state);
+                               Compare compare,
+                               size_t beam_width,
+                               Update update) {
+    update(state.best);
   }
 
-  static Line& BestLineToUpdate(State& state, const Line& new_line) {
+  template <class Compare>
+  static void Commit(State& state, Compare compare) {
+  }
+
+  static LineNode& NodeToUpdate(State& state, const Line& new_line) {
     return state;
   }
 
-  static const Line& BestLineInState(const State& final_state,
-                                     Poet::Compare compare) {
-    return final_state;
+  template <class Visit>
+  static void ForEachNode(const State& state, Visit visit) {
+    visit(state);
   }
 };
 
-template <class Strategy>
-an<Sentence> Poet::MakeSentenceWithStrategy(const WordGraph& graph,
-                                            size_t total_length,
-                                            const string& preceding_text) {
-  map<int, typename Strategy::State> states;
-  Strategy::Initiate(states[0]);
+// enumerates the lines to the final state best first, lazily, as in
+// algorithm 3 of Huang and Chiang, "Better k-best parsing" (2005): of the
+// best lines to a state, each is an edge from the preceding state; the
+// k-th best line via the edge extends the k-th best line to the preceding
+// state with the same word, by the same score. without a grammar, the
+// scores of words do not depend on the lines they follow, so that the
+// lines found are exactly the best ones; with a grammar, a word is scored
+// in the context of the best line to the preceding state, as the search
+// did, and the lines are the best of those the beam has kept.
+template <class Strategy, class Compare>
+class LineEnumerator {
+ public:
+  LineEnumerator(const map<int, typename Strategy::State>& states,
+                 const typename Strategy::State& final_state,
+                 Compare compare)
+      : states_(states), compare_(compare) {
+    Strategy::ForEachNode(final_state, [this](const LineNode& node) {
+      Push(&top_, {&node.best, &node.best, &node, 0});
+    });
+  }
+
+  // the next best line, or nullptr if there is none.
+  const Line* Next() {
+    if (last_.node) {
+      // the next best line to the same node
+      if (const Line* next = Find(last_.node, last_.rank + 1)) {
+        Push(&top_, {next, next, last_.node, last_.rank + 1});
+      }
+      last_.node = nullptr;
+    }
+    if (top_.empty())
+      return nullptr;
+    last_ = Pop(&top_);
+    return last_.line;
+  }
+
+ private:
+  struct Candidate {
+    const Line* line;
+    // the best line via the same edge
+    const Line* edge;
+    const LineNode* node;
+    // of the line via the edge, or to the node
+    size_t rank;
+    size_t order;
+  };
+
+  struct Derivations {
+    bool started = false;
+    vector<Candidate> candidates;
+    vector<const Line*> found;
+    Candidate last{};
+  };
+
+  // of the lines comparing equal, the one added first is better.
+  bool Worse(const Candidate& a, const Candidate& b) const {
+    if (compare_(*a.line, *b.line)) return true;
+    if (compare_(*b.line, *a.line)) return false;
+    return a.order > b.order;
+  }
+
+  void Push(vector<Candidate>* heap, Candidate candidate) {
+    candidate.order = num_candidates_++;
+    heap->push_back(candidate);
+    std::push_heap(heap->begin(), heap->end(),
+                   [this](const Candidate& a, const Candidate& b) {
+                     return Worse(a, b);
+                   });
+  }
+
+  Candidate Pop(vector<Candidate>* heap) {
+    std::pop_heap(heap->begin(), heap->end(),
+                  [this](const Candidate& a, const Candidate& b) {
+                    return Worse(a, b);
+                  });
+    Candidate best = heap->back();
+    heap->pop_back();
+    return best;
+  }
+
+  // the k-th best line to the node, counting from 0.
+  const Line* Find(const LineNode* node, size_t k) {
+    auto& d = derivations_[node];
+    if (!d.started) {
+      d.started = true;
+      if (node->alternatives.empty()) {
+        Push(&d.candidates, {&node->best, &node->best, node, 0});
+      }
+      for (const auto& edge : node->alternatives) {
+        Push(&d.candidates, {&edge, &edge, node, 0});
+      }
+    }
+    while (d.found.size() <= k) {
+      if (!d.found.empty() && d.last.edge) {
+        Extend(d.last, &d.candidates);
+        d.last.edge = nullptr;
+      }
+      if (d.candidates.empty())
+        return nullptr;
+      d.last = Pop(&d.candidates);
+      d.found.push_back(d.last.line);
+    }
+    return d.found[k];
+  }
+
+  // adds the next best line via the edge of the candidate.
+  void Extend(const Candidate& candidate, vector<Candidate>* heap) {
+    const Line* edge = candidate.edge;
+    const Line* predecessor = edge->predecessor;
+    if (!predecessor || predecessor->empty())
+      return;
+    const LineNode* node = NodeOf(predecessor);
+    if (!node)
+      return;
+    const Line* next = Find(node, candidate.rank + 1);
+    if (!next)
+      return;
+    double score = edge->weight - predecessor->weight;
+    lines_.push_back(next->Extend(edge->entry, edge->word_id,
+                                  edge->end_pos, next->weight + score));
+    Push(heap, {&lines_.back(), edge, candidate.node, candidate.rank + 1});
+  }
+
+  const LineNode* NodeOf(const Line* best) {
+    if (nodes_.empty()) {
+      for (const auto& sv : states_) {
+        Strategy::ForEachNode(sv.second, [this](const LineNode& node) {
+          nodes_[&node.best] = &node;
+        });
+      }
+    }
+    auto found = nodes_.find(best);
+    return found != nodes_.end() ? found->second : nullptr;
+  }
+
+  const map<int, typename Strategy::State>& states_;
+  Compare compare_;
+  vector<Candidate> top_;
+  Candidate last_{};
+  size_t num_candidates_ = 0;
+  hash_map<const LineNode*, Derivations> derivations_;
+  hash_map<const Line*, const LineNode*> nodes_;
+  // lines made by extending the lines found; stable in a deque.
+  std::deque<Line> lines_;
+};
+
+// words of a line, copied out of the states which change on later
+// keystrokes. the entries are owned by the word graph kept along.
+struct LineWord {
+  const DictEntry* entry;
+  size_t end_pos;
+  double weight;
+};
+
+using LineWords = vector<LineWord>;
+
+// the best sentences made by the poet, of distinct texts. a sentence is
+// made only when it is reached.
+class SentenceTranslation : public Translation {
+ public:
+  SentenceTranslation(const Language* language,
+                      an<WordGraph> graph,
+                      vector<LineWords> lines)
+      : language_(language),
+        graph_(std::move(graph)),
+        lines_(std::move(lines)) {
+    set_exhausted(lines_.empty());
+  }
+
+  bool Next() override;
+  an<Candidate> Peek() override;
+
+ private:
+  an<Sentence> MakeSentence(const LineWords& words) const;
+
+  const Language* language_;
+  an<WordGraph> graph_;
+  vector<LineWords> lines_;
+  size_t cursor_ = 0;
+  an<Sentence> sentence_;
+};
+
+an<Sentence> SentenceTranslation::MakeSentence(const LineWords& words) const {
+  auto sentence = New<Sentence>(language_);
+  for (const auto& w : words) {
+    sentence->Extend(*w.entry, w.end_pos, w.weight);
+  }
+  return sentence;
+}
+
+bool SentenceTranslation::Next() {
+  if (exhausted())
+    return false;
+  sentence_.reset();
+  if (++cursor_ >= lines_.size())
+    set_exhausted(true);
+  return true;
+}
+
+an<Candidate> SentenceTranslation::Peek() {
+  if (exhausted())
+    return nullptr;
+  if (!sentence_) {
+    sentence_ = MakeSentence(lines_[cursor_]);
+  }
+  return sentence_;
+}
+
+template <class Strategy, class CompareT>
+an<Translation> Poet::MakeSentenceWithStrategy(const WordGraph& word_graph,
+                                               size_t total_length,
+                                               const string& preceding_text,
+                                               size_t max_sentences,
+                                               CompareT compare) {
+  StrategySession<Strategy> scratch;
+  StrategySession<Strategy>* session = &scratch;
+  // if the session is taken by a concurrent evaluation, start over.
+  std::unique_lock<std::mutex> lock(session_mutex_, std::try_to_lock);
+  if (lock.owns_lock()) {
+    if (!session_) {
+      session_.reset(new StrategySession<Strategy>);
+    }
+    // the strategy is determined by the grammar, which does not change.
+    session = static_cast<StrategySession<Strategy>*>(session_.get());
+  }
+  const int valid_pos =
+      session->Resume(word_graph, total_length, preceding_text, max_sentences);
+  const WordGraph& graph = *session->graph;
+  auto& states = session->states;
+  using Clock = std::chrono::steady_clock;
+  const auto deadline =
+      Clock::now() + std::chrono::milliseconds(latency_ceiling_);
+  const size_t kNoLimit = (std::numeric_limits<size_t>::max)();
+  size_t beam_width = beam_width_ > 0 ? beam_width_ : kNoLimit;
+  size_t max_entries = max_entries_per_edge_ > 0 ?
+      max_entries_per_edge_ : kNoLimit;
+  bool degraded = false;
+  set<int> reaching_end;
+  if (window_size_ > 0) {
+    reaching_end = positions_reaching(graph, total_length);
+  }
+  ScoringPool* pool = nullptr;
+  // a concurrent evaluation on a scratch session runs in a single thread,
+  // as do queries to a grammar that is not thread-safe.
+  if (parallel_ && grammar_ && grammar_->thread_safe() &&
+      lock.owns_lock() &&
+      static_cast<int>(total_length) >= parallel_min_length_) {
+    if (!scoring_pool_) {
+      scoring_pool_.reset(new ScoringPool(parallel_threads_ > 0 ?
+                                          parallel_threads_ :
+                                          std::thread::hardware_concurrency()));
+    }
+    if (scoring_pool_->num_threads() > 1) {
+      pool = scoring_pool_.get();
+    }
+  }
+  struct Edge {
+    size_t end_pos;
+    const DictEntryList* entries;
+    const vector<int>* word_ids;
+    // evaluated, from the first
+    size_t num_entries;
+    // index of the score of the first entry among those from the position
+    size_t first_score;
+  };
+  vector<Edge> edges;
+  vector<const Line*> candidates;
+  vector<string> contexts;
+  vector<double> scores;
   for (const auto& sv : graph) {
     size_t start_pos = sv.first;
     if (states.find(start_pos) == states.end())
       continue;
     DLOG(INFO) << "start pos: " << start_pos;
-    const auto& source_state = states[start_pos];
-    const auto update =
-        [this, &states, &sv, start_pos, total_length, &preceding_text]
-        (const Line& candidate) {
-          for (const auto& ev : sv.second) {
-            size_t end_pos = ev.first;
-            if (start_pos == 0 && end_pos == total_length)
-              continue;  // exclude single word from the result
-            DLOG(INFO) << "end pos: " << end_pos;
-            bool is_rear = end_pos == total_length;
-            auto& target_state = states[end_pos];
-            // extend candidates with dict entries on a valid edge.
-            const DictEntryList& entries = ev.second;
-            for (const auto& entry : entries) {
-              const string& context =
-                  candidate.empty() ? preceding_text : candidate.context();
-              double weight = candidate.weight +
-                              Grammar::Evaluate(context,
-                                                entry->text,
-                                                entry->weight,
-                                                is_rear,
-                                                grammar_.get());
-              Line new_line{&candidate, entry.get(), end_pos, weight};
-              Line& best = Strategy::BestLineToUpdate(target_state, new_line);
-              if (best.empty() || compare_(best, new_line)) {
-                DLOG(INFO) << "updated line ending at " << end_pos
-                           << " with text: ..." << new_line.last_word()
-                           << " weight: " << new_line.weight;
-                best = new_line;
-              }
+    if (latency_ceiling_ > 0 && !degraded && Clock::now() > deadline) {
+      LOG(WARNING) << "sentence making hit the latency ceiling of "
+                   << latency_ceiling_ << " ms at position " << start_pos
+                   << " of " << total_length
+                   << "; searching on with a single line per position.";
+      degraded = true;
+      beam_width = 1;
+      max_entries = 1;
+      session->degraded_pos = start_pos;
+    }
+    if (window_size_ > 0 && static_cast<int>(start_pos) > valid_pos) {
+      int last_commit = session->commits.empty() ? 0 : session->commits.back();
+      if (static_cast<int>(start_pos) >= last_commit + window_size_ &&
+          reaching_end.count(start_pos)) {
+        // lines bypassing the position are given up
+        Strategy::Commit(states[start_pos], compare);
+        states.erase(states.upper_bound(start_pos), states.end());
+        session->commits.push_back(start_pos);
+        DLOG(INFO) << "committed the best line ending at " << start_pos;
+      }
+    }
+    // the edges to extend the lines ending at the position with
+    edges.clear();
+    size_t num_scores = 0;
+    auto ids = session->word_ids[start_pos].begin();
+    for (auto it = sv.second.begin(); it != sv.second.end(); ++it, ++ids) {
+      size_t end_pos = it->first;
+      if (it->first <= valid_pos)
+        continue;  // the target state is kept from the last session
+      if (start_pos == 0 && end_pos == total_length)
+        continue;  // exclude single word from the result
+      const size_t num_entries = (std::min)(it->second.size(), max_entries);
+      edges.push_back({end_pos, &it->second, &ids->second,
+                       num_entries, num_scores});
+      num_scores += num_entries;
+    }
+    if (edges.empty())
+      continue;
+    const auto evaluate =
+        [this, total_length](const string& context,
+                             const Edge& edge, size_t i) {
+          const auto& entry = (*edge.entries)[i];
+          return Grammar::Evaluate(context,
+                                   entry->text,
+                                   entry->weight,
+                                   edge.end_pos == total_length,
+                                   grammar_.get());
+        };
+    // extends the candidate with the entries on the edges, scored by
+    // score(edge, i).
+    const auto extend =
+        [&states, compare, &edges, max_sentences](const Line& candidate,
+                                                  auto score) {
+          for (const auto& edge : edges) {
+            DLOG(INFO) << "end pos: " << edge.end_pos;
+            auto& target_state = states[edge.end_pos];
+            for (size_t i = 0; i < edge.num_entries; ++i) {
+              const auto& entry = (*edge.entries)[i];
+              double weight = candidate.weight + score(edge, i);
+              int word_id = Strategy::kKeyedByWord ? (*edge.word_ids)[i] : 0;
+              Line new_line =
+                  candidate.Extend(entry.get(), word_id, edge.end_pos, weight);
+              Strategy::NodeToUpdate(target_state, new_line)
+                  .Update(new_line, compare, max_sentences);
             }
           }
         };
-    Strategy::ForEachCandidate(source_state, compare_, update);
+    const auto& source_state = states[start_pos];
+    if (!pool) {
+      Strategy::ForEachCandidate(
+          source_state, compare, beam_width,
+          [&preceding_text, &evaluate, &extend](const Line& candidate) {
+            // the same context for all words following the candidate
+            const string context =
+                candidate.empty() ? preceding_text : candidate.context();
+            extend(candidate, [&context, &evaluate](const Edge& edge,
+                                                    size_t i) {
+              return evaluate(context, edge, i);
+            });
+          });
+      continue;
+    }
+    // all entries following all candidates are scored in parallel, then
+    // the lines are extended in the same order as in a single thread.
+    candidates.clear();
+    contexts.clear();
+    Strategy::ForEachCandidate(
+        source_state, compare, beam_width,
+        [&candidates, &contexts, &preceding_text](const Line& candidate) {
+          candidates.push_back(&candidate);
+          contexts.push_back(
+              candidate.empty() ? preceding_text : candidate.context());
+        });
+    scores.resize(candidates.size() * num_scores);
+    pool->Run(candidates.size() * edges.size(),
+              [&](size_t task) {
+                const size_t c = task / edges.size();
+                const Edge& edge = edges[task % edges.size()];
+                double* edge_scores =
+                    &scores[c * num_scores + edge.first_score];
+                for (size_t i = 0; i < edge.num_entries; ++i) {
+                  edge_scores[i] = evaluate(contexts[c], edge, i);
+                }
+              });
+    for (size_t c = 0; c < candidates.size(); ++c) {
+      const double* candidate_scores = &scores[c * num_scores];
+      extend(*candidates[c], [candidate_scores](const Edge& edge, size_t i) {
+        return candidate_scores[edge.first_score + i];
+      });
+    }
   }
   auto found = states.find(total_length);
   if (found == states.end() || found->second.empty())
     return nullptr;
-  const Line& best = Strategy::BestLineInState(found->second, compare_);
-  auto sentence = New<Sentence>(language_);
-  for (const auto* c : best.components()) {
-    if (!c->entry) continue;
-    sentence->Extend(*c->entry, c->end_pos, c->weight);
+  // lines repeating the text of a better one are skipped, up to a limit.
+  const size_t kMaxLinesPerSentence = 8;
+  LineEnumerator<Strategy, CompareT> enumerator(states, found->second,
+                                                compare);
+  vector<LineWords> lines;
+  set<string> texts;
+  for (size_t n = 0;
+       lines.size() < max_sentences && n < max_sentences * kMaxLinesPerSentence;
+       ++n) {
+    const Line* line = enumerator.Next();
+    if (!line)
+      break;
+    LineWords words;
+    string text;
+    for (const auto* c : line->components()) {
+      if (!c->entry) continue;
+      words.push_back({c->entry, c->end_pos, c->weight});
+      text += c->entry->text;
+    }
+    if (texts.insert(text).second)
+      lines.push_back(std::move(words));
   }
-  return sentence;
+  return New<SentenceTranslation>(language_, session->graph, std::move(lines));
+}
+
+template <class Strategy>
+an<Translation> Poet::MakeSentenceWithStrategy(const WordGraph& graph,
+                                               size_t total_length,
+                                               const string& preceding_text,
+                                               size_t max_sentences) {
+  // the search is specialized for the known comparisons
+  using CompareFunction = bool (*)(const Line&, const Line&);
+  if (const auto* f = compare_.target<CompareFunction>()) {
+    if (*f == &Poet::CompareWeight) {
+      return MakeSentenceWithStrategy<Strategy>(
+          graph, total_length, preceding_text, max_sentences,
+          WeightOrder());
+    }
+    if (*f == &Poet::LeftAssociateCompare) {
+      return MakeSentenceWithStrategy<Strategy>(
+          graph, total_length, preceding_text, max_sentences,
+          LeftAssociateOrder());
+    }
+  }
+  return MakeSentenceWithStrategy<Strategy>(
+      graph, total_length, preceding_text, max_sentences,
+      compare_);
 }
 
 an<Sentence> Poet::MakeSentence(const WordGraph& graph,
                                 size_t total_length,
                                 const string& preceding_text) {
+  auto translation = MakeSentences(graph, total_length, preceding_text, 1);
+  return translation ? As<Sentence>(translation->Peek()) : nullptr;
+}
+
+an<Translation> Poet::MakeSentences(const WordGraph& graph,
+                                    size_t total_length,
+                                    const string& preceding_text,
+                                    size_t max_sentences) {
+  if (max_sentences == 0)
+    return nullptr;
   return grammar_ ?
       MakeSentenceWithStrategy<BeamSearch>(
-          graph, total_length, preceding_text) :
+          graph, total_length, preceding_text, max_sentences) :
       MakeSentenceWithStrategy<DynamicProgramming>(
-          graph, total_length, preceding_text);
+          graph, total_length, preceding_text, max_sentences);
 }
 
 }  // namespace rime
@@ -10,6 +10,7 @@
 #ifndef RIME_POET_H_
 #define RIME_POET_H_
 
+#include <mutex>
 #include <rime/common.h>
 #include <rime/translation.h>
 #include <rime/gear/translator_commons.h>
@@ -22,6 +23,8 @@ using WordGraph = map<int, map<int, DictEntryList>>;
 class Grammar;
 class Language;
 struct Line;
+class PoetSession;
+class ScoringPool;
 
 class Poet {
  public:
@@ -38,6 +41,15 @@ class Poet {
   an<Sentence> MakeSentence(const WordGraph& graph,
                             size_t total_length,
                             const string& preceding_text);
+  // up to max_sentences of the best sentences of distinct texts, best
+  // first, enumerated from the best lines kept to each position. without a
+  // grammar they are the best of all in the word graph; with a grammar, of
+  // those within the beam, with each word scored in the context of the best
+  // line before it. each sentence is made when the translation reaches it.
+  an<Translation> MakeSentences(const WordGraph& graph,
+                                size_t total_length,
+                                const string& preceding_text,
+                                size_t max_sentences);
 
   template <class TranslatorT>
   an<Translation> ContextualWeighted(an<Translation> translation,
@@ -57,13 +69,45 @@ class Poet {
 
  private:
   template <class Strategy>
-  an<Sentence> MakeSentenceWithStrategy(const WordGraph& graph,
-                                        size_t total_length,
-                                        const string& preceding_text);
+  an<Translation> MakeSentenceWithStrategy(const WordGraph& graph,
+                                           size_t total_length,
+                                           const string& preceding_text,
+                                           size_t max_sentences);
+  template <class Strategy, class CompareT>
+  an<Translation> MakeSentenceWithStrategy(const WordGraph& graph,
+                                           size_t total_length,
+                                           const string& preceding_text,
+                                           size_t max_sentences,
+                                           CompareT compare);
 
   const Language* language_;
   the<Grammar> grammar_;
   Compare compare_;
+  // limits to the work of making a sentence; zero for no limit.
+  // number of best lines extended from each position, if less than the
+  // strategy keeps.
+  int beam_width_ = 0;
+  int max_entries_per_edge_ = 0;
+  // after advancing so many positions, the best line at the current
+  // position is committed as the prefix of the sentence.
+  int window_size_ = 0;
+  // in milliseconds; past it, the rest of the graph is searched with a
+  // single line per position and a single entry per edge.
+  int latency_ceiling_ = 0;
+  // if enabled, the edges from each position are scored on a pool of
+  // threads for inputs of at least parallel_min_length; the sentences made
+  // are the same as in a single thread. only grammars that are
+  // thread_safe() are queried in parallel; others are queried in a single
+  // thread regardless.
+  bool parallel_ = false;
+  int parallel_min_length_ = 16;
+  // zero for as many threads as the hardware runs concurrently.
+  int parallel_threads_ = 0;
+  // states of the last sentence made, resumed on the next keystroke.
+  std::mutex session_mutex_;
+  the<PoetSession> session_;
+  // created on first use; used only by the owner of the session.
+  the<ScoringPool> scoring_pool_;
 };
 
 }  // namespace rime
@@ -7,6 +7,7 @@
 // 2011-07-10 GONG Chen <chen.sst@gmail.com>
 //
 #include <algorithm>
+#include <chrono>
 #include <stack>
 #include <boost/algorithm/string/join.hpp>
 #include <boost/range/adaptor/reversed.hpp>
@@ -98,6 +99,9 @@ class ScriptSyllabifier : public PhraseSyllabifier {
   size_t start_;
   Syllabifier syllabifier_;
   SyllableGraph syllable_graph_;
+
+ private:
+  const SyllablePath* RecordedPath(const Phrase& cand) const;
 };
 
 class ScriptTranslation : public Translation {
@@ -112,6 +116,7 @@ class ScriptTranslation : public Translation {
         start_(start),
         syllabifier_(New<ScriptSyllabifier>(
             translator, corrector, input, start)),
+        preceding_text_(translator->GetPrecedingText(start)),
         enable_correction_(corrector) {
     set_exhausted(true);
   }
@@ -119,24 +124,35 @@ class ScriptTranslation : public Translation {
   virtual bool Next();
   virtual an<Candidate> Peek();
 
+  void set_cancelled(an<std::atomic<bool>> cancelled) {
+    cancelled_ = cancelled;
+  }
+
  protected:
+  bool cancelled() const { return cancelled_ && *cancelled_; }
   bool CheckEmpty();
   bool PreferUserPhrase();
   bool IsNormalSpelling() const;
   void PrepareCandidate();
+  bool TakeNextSentence();
   template <class QueryResult>
   void EnrollEntries(map<int, DictEntryList>& entries_by_end_pos,
                      const an<QueryResult>& query_result);
-  an<Sentence> MakeSentence(Dictionary* dict, UserDictionary* user_dict);
+  an<Translation> MakeSentences(Dictionary* dict, UserDictionary* user_dict);
 
   ScriptTranslator* translator_;
   Poet* poet_;
   size_t start_;
   an<ScriptSyllabifier> syllabifier_;
+  // captured up front, as evaluation may run off the engine's thread.
+  string preceding_text_;
+  an<std::atomic<bool>> cancelled_;
 
   an<DictEntryCollector> phrase_;
   an<UserDictEntryCollector> user_phrase_;
+  // the sentence to show, taken from the best sentences made
   an<Sentence> sentence_;
+  an<Translation> sentences_;
 
   an<Phrase> candidate_ = nullptr;
 
@@ -149,6 +165,44 @@ class ScriptTranslation : public Translation {
   bool enable_correction_;
 };
 
+// Hands out candidates of a script translation being evaluated on a
+// background worker. Asking for a candidate before the evaluation has
+// completed waits for it; discarding the translation cancels the work.
+class AsyncTranslation : public Translation {
+ public:
+  AsyncTranslation(ScriptTranslator* translator,
+                   std::shared_future<an<Translation>> work,
+                   an<std::atomic<bool>> cancelled,
+                   const string& input,
+                   size_t start)
+      : translator_(translator),
+        work_(work),
+        cancelled_(cancelled),
+        input_(input),
+        start_(start) {}
+  ~AsyncTranslation() {
+    *cancelled_ = true;
+  }
+
+  virtual bool Next();
+  virtual an<Candidate> Peek();
+  virtual int Compare(an<Translation> other,
+                      const CandidateList& candidates);
+  // results are complete only if taken before the work was cancelled.
+  bool cancelled() const override { return *cancelled_ && !result_; }
+
+ protected:
+  bool Wait();
+
+  ScriptTranslator* translator_;
+  std::shared_future<an<Translation>> work_;
+  an<std::atomic<bool>> cancelled_;
+  string input_;
+  size_t start_;
+  an<Translation> result_;
+  bool ready_ = false;
+};
+
 // ScriptTranslator implementation
 
 ScriptTranslator::ScriptTranslator(const Ticket& ticket)
@@ -163,6 +217,15 @@ ScriptTranslator::ScriptTranslator(const Ticket& ticket)
                     &always_show_comments_);
     config->GetBool(name_space_ + "/enable_correction", &enable_correction_);
     config->GetInt(name_space_ + "/max_homophones", &max_homophones_);
+    config->GetInt(name_space_ + "/max_sentences", &max_sentences_);
+    if (max_sentences_ < 0) {
+      LOG(WARNING) << "invalid " << name_space_ << "/max_sentences: "
+                   << max_sentences_ << "; making one sentence.";
+      max_sentences_ = 1;
+    }
+    config->GetBool(name_space_ + "/async_compose", &async_compose_);
+    config->GetInt(name_space_ + "/async_compose_min_length",
+                   &async_compose_min_length_);
     poet_.reset(new Poet(language(), config));
   }
   if (enable_correction_) {
@@ -172,6 +235,10 @@ ScriptTranslator::ScriptTranslator(const Ticket& ticket)
   }
 }
 
+ScriptTranslator::~ScriptTranslator() {
+  CancelPendingWork();
+}
+
 an<Translation> ScriptTranslator::Query(const string& input,
                                         const Segment& segment) {
   if (!dict_ || !dict_->loaded())
@@ -181,6 +248,9 @@ an<Translation> ScriptTranslator::Query(const string& input,
   DLOG(INFO) << "input = '" << input
              << "', [" << segment.start << ", " << segment.end << ")";
 
+  // a new query supersedes the translation of the same segment still
+  // being evaluated; other segments of the composition are kept.
+  CancelPendingWork(segment.start);
   FinishSession();
 
   bool enable_user_dict = user_dict_ && user_dict_->loaded() &&
@@ -192,18 +262,106 @@ an<Translation> ScriptTranslator::Query(const string& input,
                                        poet_.get(),
                                        input,
                                        segment.start);
-  if (!result ||
-      !result->Evaluate(dict_.get(),
+  if (!result)
+    return nullptr;
+  if (async_compose_ &&
+      input.length() >= static_cast<size_t>(async_compose_min_length_)) {
+    return EvaluateAsync(result,
+                         dict_.get(),
+                         enable_user_dict ? user_dict_.get() : NULL,
+                         input,
+                         segment.start);
+  }
+  if (!result->Evaluate(dict_.get(),
                         enable_user_dict ? user_dict_.get() : NULL)) {
     return nullptr;
   }
-  auto deduped = New<DistinctTranslation>(result);
+  return Decorate(result, input, segment.start);
+}
+
+an<Translation> ScriptTranslator::Decorate(an<Translation> translation,
+                                           const string& input,
+                                           size_t start) {
+  auto deduped = New<DistinctTranslation>(translation);
   if (contextual_suggestions_) {
-    return poet_->ContextualWeighted(deduped, input, segment.start, this);
+    return poet_->ContextualWeighted(deduped, input, start, this);
   }
   return deduped;
 }
 
+an<Translation> ScriptTranslator::EvaluateAsync(
+    an<ScriptTranslation> translation,
+    Dictionary* dict,
+    UserDictionary* user_dict,
+    const string& input,
+    size_t start) {
+  auto cancelled = New<std::atomic<bool>>(false);
+  translation->set_cancelled(cancelled);
+  Engine* engine = engine_;
+  auto result = New<std::promise<an<Translation>>>();
+  std::shared_future<an<Translation>> work = result->get_future().share();
+  // workers share the dictionaries and poet; they run one at a time, in
+  // the order of the queries. the front end may use the poet meanwhile: it
+  // makes sentences of its own if a worker holds its session, and queries
+  // to its grammar are serialized unless the grammar is thread-safe.
+  vector<std::shared_future<void>> earlier_work;
+  for (const auto& pending : pending_work_) {
+    earlier_work.push_back(pending.second.done);
+  }
+  auto done = std::async(
+      std::launch::async,
+      [translation, dict, user_dict, cancelled, engine, result,
+       earlier_work]() {
+        for (const auto& earlier : earlier_work) {
+          earlier.wait();
+        }
+        // the worker allocates from an arena of its own, so that it does
+        // not contend with the front end for the menu's arena.
+        auto arena = New<Arena>();
+        Arena::Scope scope(arena.get());
+        bool success = !*cancelled && translation->Evaluate(dict, user_dict);
+        if (*cancelled || !success) {
+          result->set_value(nullptr);
+          return;
+        }
+        result->set_value(translation);
+        // once the result is published, the front end is told to fetch the
+        // menu again, without waiting for its next call into the session.
+        engine->SendAsyncMessage("menu", "ready");
+      }).share();
+  pending_work_[start] = {cancelled, done};
+  return New<AsyncTranslation>(this, work, cancelled, input, start);
+}
+
+void ScriptTranslator::CancelPendingWork(size_t start) {
+  for (auto it = pending_work_.begin(); it != pending_work_.end(); ) {
+    const auto& pending = it->second;
+    if (it->first == start) {
+      *pending.cancelled = true;
+      // wait for the worker to bail out
+      pending.done.wait();
+    }
+    // forget finished work
+    if (pending.done.wait_for(std::chrono::seconds(0)) ==
+        std::future_status::ready) {
+      it = pending_work_.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+}
+
+void ScriptTranslator::CancelPendingWork() {
+  for (const auto& pending : pending_work_) {
+    *pending.second.cancelled = true;
+  }
+  for (const auto& pending : pending_work_) {
+    pending.second.done.wait();
+  }
+  pending_work_.clear();
+}
+
 string ScriptTranslator::FormatPreedit(const string& preedit) {
   string result = preedit;
   preedit_formatter_.Apply(&result);
@@ -228,6 +386,9 @@ string ScriptTranslator::GetPrecedingText(size_t start) const {
 }
 
 bool ScriptTranslator::Memorize(const CommitEntry& commit_entry) {
+  // the composition is done with; workers must not read the user dictionary
+  // while it is updated.
+  CancelPendingWork();
   bool update_elements = false;
   // avoid updating single character entries within a phrase which is
   // composed with single characters only
@@ -250,10 +411,27 @@ bool ScriptTranslator::Memorize(const CommitEntry& commit_entry) {
 
 // ScriptSyllabifier implementation
 
+// The syllables of the candidate as recorded by the dictionary lookup, or
+// nullptr if it has not been looked up in the syllable graph.
+const SyllablePath* ScriptSyllabifier::RecordedPath(const Phrase& cand) const {
+  const auto& path = cand.entry().path;
+  if (path.empty() || path.size() != cand.code().size() ||
+      path.back().end_pos != cand.end() - start_)
+    return nullptr;
+  return &path;
+}
+
 Spans ScriptSyllabifier::Syllabify(const Phrase* phrase) {
   Spans result;
   vector<size_t> vertices;
   vertices.push_back(start_);
+  if (const auto* path = RecordedPath(*phrase)) {
+    for (const auto& step : *path) {
+      vertices.push_back(start_ + step.end_pos);
+    }
+    result.set_vertices(std::move(vertices));
+    return result;
+  }
   SyllabifyTask task{
     phrase->code(),
     syllable_graph_,
@@ -279,6 +457,13 @@ size_t ScriptSyllabifier::BuildSyllableGraph(Prism& prism) {
 }
 
 bool ScriptSyllabifier::IsCandidateCorrection(const rime::Phrase &cand) const {
+  if (const auto* path = RecordedPath(cand)) {
+    for (const auto& step : *path) {
+      if (step.is_correction)
+        return true;
+    }
+    return false;
+  }
   std::stack<bool> results;
   // Perform DFS on syllable graph to find whether this candidate is a correction
   SyllabifyTask task {
@@ -318,8 +503,20 @@ bool ScriptSyllabifier::IsCandidateCorrection(const rime::Phrase &cand) const {
 
 string ScriptSyllabifier::GetPreeditString(const Phrase& cand) const {
   const auto& delimiters = translator_->delimiters();
-  std::stack<size_t> lengths;
   string output;
+  if (const auto* path = RecordedPath(cand)) {
+    size_t current_pos = cand.start() - start_;
+    for (const auto& step : *path) {
+      size_t len = output.length();
+      if (len > 0 && delimiters.find(output[len - 1]) == string::npos) {
+        output += delimiters.at(0);
+      }
+      output.append(input_, current_pos, step.end_pos - current_pos);
+      current_pos = step.end_pos;
+    }
+    return translator_->FormatPreedit(output);
+  }
+  std::stack<size_t> lengths;
   SyllabifyTask task{
     cand.code(),
     syllable_graph_,
@@ -355,11 +552,48 @@ string ScriptSyllabifier::GetOriginalSpelling(const Phrase& cand) const {
   return string();
 }
 
+// AsyncTranslation implementation
+
+bool AsyncTranslation::Wait() {
+  if (!ready_) {
+    ready_ = true;
+    if (auto translation = work_.get()) {
+      result_ = translator_->Decorate(translation, input_, start_);
+    }
+    set_exhausted(!result_ || result_->exhausted());
+  }
+  return !exhausted();
+}
+
+bool AsyncTranslation::Next() {
+  if (exhausted() || !Wait())
+    return false;
+  result_->Next();
+  if (result_->exhausted()) {
+    set_exhausted(true);
+  }
+  return true;
+}
+
+an<Candidate> AsyncTranslation::Peek() {
+  if (exhausted() || !Wait())
+    return nullptr;
+  return result_->Peek();
+}
+
+int AsyncTranslation::Compare(an<Translation> other,
+                              const CandidateList& candidates) {
+  Wait();
+  return Translation::Compare(other, candidates);
+}
+
 // ScriptTranslation implementation
 
 bool ScriptTranslation::Evaluate(Dictionary* dict, UserDictionary* user_dict) {
   size_t consumed = syllabifier_->BuildSyllableGraph(*dict->prism());
   const auto& syllable_graph = syllabifier_->syllable_graph();
+  if (cancelled())
+    return false;
 
   phrase_ = dict->Lookup(syllable_graph, 0);
   if (user_dict) {
@@ -367,6 +601,8 @@ bool ScriptTranslation::Evaluate(Dictionary* dict, UserDictionary* user_dict) {
   }
   if (!phrase_ && !user_phrase_)
     return false;
+  if (cancelled())
+    return false;
   // make sentences when there is no exact-matching phrase candidate
   size_t translated_len = 0;
   if (phrase_ && !phrase_->empty())
@@ -391,7 +627,8 @@ bool ScriptTranslation::Evaluate(Dictionary* dict, UserDictionary* user_dict) {
 
   if ((translated_len < consumed || is_first_candidate_a_correction) &&
       syllable_graph.edges.size() > 1) {  // at least 2 syllables required
-    sentence_ = MakeSentence(dict, user_dict);
+    sentences_ = MakeSentences(dict, user_dict);
+    TakeNextSentence();
   }
 
   return !CheckEmpty();
@@ -404,7 +641,7 @@ bool ScriptTranslation::Next() {
     if (exhausted())
       return false;
     if (sentence_) {
-      sentence_.reset();
+      TakeNextSentence();
       return !CheckEmpty();
     }
     int phrase_code_length = 0;
@@ -490,6 +727,19 @@ bool ScriptTranslation::PreferUserPhrase() {
          (user_phrase_code_length > phrase_code_length || user_phrase_weight >= phrase_weight);
 }
 
+bool ScriptTranslation::TakeNextSentence() {
+  sentence_.reset();
+  if (!sentences_ || sentences_->exhausted())
+    return false;
+  sentence_ = As<Sentence>(sentences_->Peek());
+  sentences_->Next();
+  if (!sentence_)
+    return false;
+  sentence_->Offset(start_);
+  sentence_->set_syllabifier(syllabifier_);
+  return true;
+}
+
 void ScriptTranslation::PrepareCandidate() {
   if (exhausted()) {
     candidate_ = nullptr;
@@ -560,31 +810,51 @@ void ScriptTranslation::EnrollEntries(
   }
 }
 
-an<Sentence> ScriptTranslation::MakeSentence(Dictionary* dict,
-                                             UserDictionary* user_dict) {
-  const int kMaxSyllablesForUserPhraseQuery = 5;
+an<Translation> ScriptTranslation::MakeSentences(Dictionary* dict,
+                                                 UserDictionary* user_dict) {
+  const size_t kMaxSyllablesForUserPhraseQuery = 5;
   const auto& syllable_graph = syllabifier_->syllable_graph();
+  // reuse the phrases looked up from position 0, working on copies as
+  // the originals are yet to be iterated for candidates.
+  map<size_t, an<DictEntryCollector>> phrases;
+  phrases[0] = phrase_ ? New<DictEntryCollector>(*phrase_) : nullptr;
+  map<size_t, an<UserDictEntryCollector>> user_phrases;
+  if (user_dict) {
+    auto& user_phrase = user_phrases[0];
+    if (user_phrase_) {
+      user_phrase = New<UserDictEntryCollector>(*user_phrase_);
+      // phrases at position 0 were looked up without the depth limit
+      for (auto& y : *user_phrase) {
+        y.second.AddFilter([=](an<DictEntry> e) {
+          return e->code.size() <= kMaxSyllablesForUserPhraseQuery;
+        });
+      }
+    }
+    user_dict->LookupAll(syllable_graph, &user_phrases,
+                         kMaxSyllablesForUserPhraseQuery);
+  }
+  if (cancelled())
+    return nullptr;
+  dict->LookupAll(syllable_graph, &phrases);
+  if (cancelled())
+    return nullptr;
   WordGraph graph;
   for (const auto& x : syllable_graph.edges) {
     auto& same_start_pos = graph[x.first];
-    if (user_dict) {
-      EnrollEntries(same_start_pos,
-                    user_dict->Lookup(syllable_graph,
-                                      x.first,
-                                      kMaxSyllablesForUserPhraseQuery));
+    auto user_phrase = user_phrases.find(x.first);
+    if (user_phrase != user_phrases.end()) {
+      EnrollEntries(same_start_pos, user_phrase->second);
     }
     // merge lookup results
-    EnrollEntries(same_start_pos, dict->Lookup(syllable_graph, x.first));
-  }
-  if (auto sentence =
-      poet_->MakeSentence(graph,
-                          syllable_graph.interpreted_length,
-                          translator_->GetPrecedingText(start_))) {
-    sentence->Offset(start_);
-    sentence->set_syllabifier(syllabifier_);
-    return sentence;
+    auto phrase = phrases.find(x.first);
+    if (phrase != phrases.end()) {
+      EnrollEntries(same_start_pos, phrase->second);
+    }
   }
-  return nullptr;
+  return poet_->MakeSentences(graph,
+                              syllable_graph.interpreted_length,
+                              preceding_text_,
+                              translator_->max_sentences());
 }
 
 }  // namespace rime
@@ -7,6 +7,8 @@
 #ifndef RIME_SCRIPT_TRANSLATOR_H_
 #define RIME_SCRIPT_TRANSLATOR_H_
 
+#include <atomic>
+#include <future>
 #include <rime/common.h>
 #include <rime/translation.h>
 #include <rime/translator.h>
@@ -21,6 +23,7 @@ class Corrector;
 struct DictEntry;
 class Dictionary;
 class Poet;
+class ScriptTranslation;
 class UserDictionary;
 struct SyllableGraph;
 
@@ -29,10 +32,14 @@ class ScriptTranslator : public Translator,
                          public TranslatorOptions {
  public:
   ScriptTranslator(const Ticket& ticket);
+  virtual ~ScriptTranslator();
 
   virtual an<Translation> Query(const string& input,
                                 const Segment& segment);
   virtual bool Memorize(const CommitEntry& commit_entry);
+  an<Translation> Decorate(an<Translation> translation,
+                           const string& input,
+                           size_t start);
 
   string FormatPreedit(const string& preedit);
   string Spell(const Code& code);
@@ -40,16 +47,37 @@ class ScriptTranslator : public Translator,
 
   // options
   int max_homophones() const { return max_homophones_; }
+  int max_sentences() const { return max_sentences_; }
   int spelling_hints() const { return spelling_hints_; }
   bool always_show_comments() const { return always_show_comments_; }
+  bool async_compose() const { return async_compose_; }
 
  protected:
+  an<Translation> EvaluateAsync(an<ScriptTranslation> translation,
+                                Dictionary* dict,
+                                UserDictionary* user_dict,
+                                const string& input,
+                                size_t start);
+  // cancels and joins the work for the segment, which is being replaced.
+  void CancelPendingWork(size_t start);
+  void CancelPendingWork();
+
   int max_homophones_ = 1;
+  int max_sentences_ = 1;
   int spelling_hints_ = 0;
   bool always_show_comments_ = false;
   bool enable_correction_ = false;
+  bool async_compose_ = false;
+  int async_compose_min_length_ = 8;
   the<Corrector> corrector_;
   the<Poet> poet_;
+  struct PendingWork {
+    an<std::atomic<bool>> cancelled;
+    // ready when the worker has returned, after publishing its result.
+    std::shared_future<void> done;
+  };
+  // translations being evaluated on background workers, by segment start.
+  map<size_t, PendingWork> pending_work_;
 };
 
 }  // namespace rime
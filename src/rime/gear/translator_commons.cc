@@ -93,6 +93,13 @@ void Sentence::Extend(const DictEntry& another,
                       double new_weight) {
   entry_->weight = new_weight;
   entry_->text.append(another.text);
+  // the path stays complete only if every component has one
+  if (entry_->path.size() == entry_->code.size() &&
+      another.path.size() == another.code.size()) {
+    entry_->path.insert(entry_->path.end(),
+                        another.path.begin(),
+                        another.path.end());
+  }
   entry_->code.insert(entry_->code.end(),
                       another.code.begin(),
                       another.code.end());
@@ -22,6 +22,9 @@
 #include <rime/algo/utilities.h>
 #include <rime/dict/dictionary.h>
 #include <rime/dict/dict_compiler.h>
+#include <rime/dict/db_utils.h>
+#include <rime/dict/ngram_model.h>
+#include <rime/dict/tsv.h>
 #include <rime/lever/deployment_tasks.h>
 #include <rime/lever/user_dict_manager.h>
 #ifdef _WIN32
@@ -682,4 +685,85 @@ bool CleanOldLogFiles::Run(Deployer* deployer) {
   return success;
 }
 
+GrammarModelUpdate::GrammarModelUpdate(TaskInitializer arg) {
+  try {
+    auto args = boost::any_cast<vector<string>>(arg);
+    if (args.size() == 2) {
+      language_ = args[0];
+      counts_file_ = args[1];
+    }
+  }
+  catch (const boost::bad_any_cast&) {
+    LOG(ERROR) << "GrammarModelUpdate: invalid arguments.";
+  }
+}
+
+namespace {
+
+class NgramCountSink : public Sink {
+ public:
+  explicit NgramCountSink(vector<ngram::Count>* counts) : counts_(counts) {}
+
+  bool MetaPut(const string& key, const string& value) override {
+    return true;
+  }
+  bool Put(const string& key, const string& value) override {
+    ngram::Count x;
+    boost::algorithm::split(x.words, key,
+                            boost::algorithm::is_any_of(" "),
+                            boost::algorithm::token_compress_on);
+    try {
+      x.count = std::stod(value);
+    }
+    catch (...) {
+      return false;
+    }
+    counts_->push_back(std::move(x));
+    return true;
+  }
+
+ private:
+  vector<ngram::Count>* counts_;
+};
+
+}  // namespace
+
+static bool ngram_count_parser(const Tsv& row, string* key, string* value) {
+  if (row.size() != 2 || row[0].empty())
+    return false;
+  *key = row[0];
+  *value = row[1];
+  return true;
+}
+
+bool GrammarModelUpdate::Run(Deployer* deployer) {
+  if (language_.empty() || !fs::exists(counts_file_)) {
+    LOG(ERROR) << "Error updating grammar model: nonexistent file '"
+               << counts_file_ << "'.";
+    return false;
+  }
+  vector<ngram::Count> counts;
+  NgramCountSink sink(&counts);
+  TsvReader reader(counts_file_, ngram_count_parser);
+  if (reader(&sink) == 0) {
+    LOG(ERROR) << "no n-gram counts in '" << counts_file_ << "'.";
+    return false;
+  }
+  if (!MaybeCreateDirectory(deployer->staging_dir)) {
+    return false;
+  }
+  fs::path model_path =
+      fs::path(deployer->staging_dir) / (language_ + ".ngram.bin");
+  NgramModel model(model_path.string());
+  if (!model.Build(counts) || !model.Save()) {
+    LOG(ERROR) << "Error building n-gram model '" << model_path.string()
+               << "'.";
+    return false;
+  }
+  LOG(INFO) << "built n-gram model '" << model_path.string() << "': "
+            << model.num_ngrams() << " n-grams, "
+            << model.file_size() << " bytes.";
+  return true;
+}
+
 }  // namespace rime
@@ -115,6 +115,20 @@ class CleanOldLogFiles : public DeploymentTask {
   bool Run(Deployer* deployer);
 };
 
+// build the n-gram model of a language for the grammar, from a file of
+// lines "<words separated by spaces>\t<count>".
+class GrammarModelUpdate : public DeploymentTask {
+ public:
+  GrammarModelUpdate(const string& language, const string& counts_file)
+      : language_(language), counts_file_(counts_file) {}
+  GrammarModelUpdate(TaskInitializer arg);
+  bool Run(Deployer* deployer);
+
+ protected:
+  string language_;
+  string counts_file_;
+};
+
 }  // namespace rime
 
 #endif  // RIME_DEPLOYMENT_TASKS_H_
@@ -35,6 +35,7 @@ static void rime_levers_initialize() {
   r.Register("user_dict_sync", new Component<UserDictSync>);
   r.Register("backup_config_files", new Component<BackupConfigFiles>);
   r.Register("clean_old_log_files", new Component<CleanOldLogFiles>);
+  r.Register("grammar_model_update", new Component<GrammarModelUpdate>);
 }
 
 static void rime_levers_finalize() {
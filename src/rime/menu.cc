@@ -13,10 +13,17 @@
 namespace rime {
 
 Menu::Menu()
-    : merged_(new MergedTranslation(candidates_)),
+    : arena_(New<Arena>()),
+      merged_(new MergedTranslation(candidates_)),
       result_(merged_) {
 }
 
+Menu::~Menu() {
+  DLOG(INFO) << "menu arena: " << arena_->num_allocations()
+             << " allocations in " << arena_->num_blocks() << " blocks, "
+             << arena_->bytes_allocated() << " bytes.";
+}
+
 void Menu::AddTranslation(an<Translation> translation) {
   *merged_ += translation;
   DLOG(INFO) << merged_->size() << " translations added.";
@@ -28,6 +35,7 @@ void Menu::AddFilter(Filter* filter) {
 
 size_t Menu::Prepare(size_t requested) {
   DLOG(INFO) << "preparing " << requested << " candidates.";
+  Arena::Scope scope(arena_.get());
   while (candidates_.size() < requested && !result_->exhausted()) {
     if (auto cand = result_->Peek()) {
       candidates_.push_back(cand);
@@ -73,4 +81,8 @@ bool Menu::empty() const {
   return candidates_.empty() && result_->exhausted();
 }
 
+bool Menu::cancelled() const {
+  return merged_->cancelled();
+}
+
 }  // namespace rime
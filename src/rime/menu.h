@@ -27,6 +27,7 @@ class Translation;
 class Menu {
  public:
   RIME_API Menu();
+  RIME_API ~Menu();
 
   RIME_API void AddTranslation(an<Translation> translation);
   void AddFilter(Filter* filter);
@@ -41,7 +42,14 @@ class Menu {
 
   bool empty() const;
 
+  // whether any of the translations has been cancelled.
+  bool cancelled() const;
+
+  // backs the translations and candidates created for this menu.
+  Arena* arena() const { return arena_.get(); }
+
  private:
+  an<Arena> arena_;
   an<MergedTranslation> merged_;
   an<Translation> result_;
   CandidateList candidates_;
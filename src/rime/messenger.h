@@ -7,6 +7,7 @@
 #ifndef RIME_MESSENGER_H_
 #define RIME_MESSENGER_H_
 
+#include <mutex>
 #include <rime/common.h>
 
 namespace rime {
@@ -18,8 +19,23 @@ class Messenger {
 
   MessageSink& message_sink() { return message_sink_; }
 
+  // receives messages from background work, on the thread doing the work;
+  // the slots connected to it must be thread-safe.
+  MessageSink& async_message_sink() { return async_message_sink_; }
+
+  // sends a message from a background thread right away, one at a time.
+  void SendAsyncMessage(const string& message_type,
+                        const string& message_value) {
+    std::lock_guard<std::mutex> lock(async_mutex_);
+    async_message_sink_(message_type, message_value);
+  }
+
  protected:
   MessageSink message_sink_;
+
+ private:
+  std::mutex async_mutex_;
+  MessageSink async_message_sink_;
 };
 
 }  // namespace rime
@@ -20,6 +20,9 @@ Session::Session() {
   SessionId session_id = reinterpret_cast<SessionId>(this);
   engine_->message_sink().connect(
       std::bind(&Service::Notify, &Service::instance(), session_id, _1, _2));
+  // the notification handler is called from the deployer's thread, too.
+  engine_->async_message_sink().connect(
+      std::bind(&Service::Notify, &Service::instance(), session_id, _1, _2));
 }
 
 bool Session::ProcessKey(const KeyEvent& key_event) {
@@ -4,8 +4,11 @@
 //
 // 2011-05-21 GONG Chen <chen.sst@gmail.com>
 //
+#include <algorithm>
+#include <limits>
 #include <rime/candidate.h>
 #include <rime/translation.h>
+#include <rime/algo/utilities.h>
 
 namespace rime {
 
@@ -117,39 +120,81 @@ MergedTranslation::MergedTranslation(const CandidateList& candidates)
   set_exhausted(true);
 }
 
+static const int kNoVerdict = std::numeric_limits<int>::min();
+
 bool MergedTranslation::Next() {
+  if (pending_election_) {
+    Elect();
+  }
   if (exhausted()) {
     return false;
   }
   translations_[elected_]->Next();
+  Invalidate(elected_);
   if (translations_[elected_]->exhausted()) {
     DLOG(INFO) << "translation #" << elected_ << " has been exhausted.";
-    translations_.erase(translations_.begin() + elected_);
+    Remove(elected_);
   }
   Elect();
   return !exhausted();
 }
 
 an<Candidate> MergedTranslation::Peek() {
+  if (pending_election_) {
+    Elect();
+  }
   if (exhausted()) {
     return nullptr;
   }
   return translations_[elected_]->Peek();
 }
 
+// forgets the verdicts involving translation #k.
+void MergedTranslation::Invalidate(size_t k) {
+  verdicts_[k] = kNoVerdict;
+  if (k > 0) {
+    verdicts_[k - 1] = kNoVerdict;
+  }
+}
+
+bool MergedTranslation::cancelled() const {
+  return lost_cancelled_ ||
+      std::any_of(translations_.begin(), translations_.end(),
+                  [](const an<Translation>& t) { return t->cancelled(); });
+}
+
+void MergedTranslation::Remove(size_t k) {
+  if (translations_[k]->cancelled()) {
+    lost_cancelled_ = true;
+  }
+  translations_.erase(translations_.begin() + k);
+  verdicts_.erase(verdicts_.begin() + k);
+  if (k > 0) {
+    verdicts_[k - 1] = kNoVerdict;
+  }
+}
+
+// Translations are polled in order; #k is elected once it no longer gives
+// way to #k+1. Only the pairs involving the translation that advanced last
+// are compared again, the other verdicts are taken from the cache.
 void MergedTranslation::Elect() {
+  pending_election_ = false;
   if (translations_.empty()) {
     set_exhausted(true);
     return;
   }
   size_t k = 0;
   for (; k < translations_.size(); ++k) {
-    const auto& current = translations_[k];
-    const auto& next = k + 1 < translations_.size() ?
-                               translations_[k + 1] : nullptr;
-    if (current->Compare(next, previous_candidates_) <= 0) {
-      if (current->exhausted()) {
-        translations_.erase(translations_.begin() + k);
+    int& verdict = verdicts_[k];
+    if (verdict == kNoVerdict) {
+      const auto& current = translations_[k];
+      const auto& next = k + 1 < translations_.size() ?
+                                 translations_[k + 1] : nullptr;
+      verdict = current->Compare(next, previous_candidates_);
+    }
+    if (verdict <= 0) {
+      if (translations_[k]->exhausted()) {
+        Remove(k);
         k = 0;
         continue;
       }
@@ -169,7 +214,11 @@ void MergedTranslation::Elect() {
 MergedTranslation& MergedTranslation::operator+= (an<Translation> t) {
   if (t && !t->exhausted()) {
     translations_.push_back(t);
-    Elect();
+    verdicts_.push_back(kNoVerdict);
+    // the former last one used to be compared with none.
+    Invalidate(translations_.size() - 1);
+    pending_election_ = true;
+    set_exhausted(false);
   }
   return *this;
 }
@@ -210,7 +259,8 @@ DistinctTranslation::DistinctTranslation(an<Translation> translation)
 bool DistinctTranslation::Next() {
   if (exhausted())
     return false;
-  candidate_set_.insert(Peek()->text());
+  // the current candidate has been checked to be distinct.
+  Remember(Peek()->text());
   do {
     CacheTranslation::Next();
   }
@@ -220,7 +270,13 @@ bool DistinctTranslation::Next() {
 }
 
 bool DistinctTranslation::AlreadyHas(const string& text) const {
-  return candidate_set_.find(text) != candidate_set_.end();
+  // texts of different 64-bit hashes are distinct; the converse is taken
+  // for granted, as a collision is far less likely than a hardware error.
+  return yielded_.count(HashText(text)) != 0;
+}
+
+void DistinctTranslation::Remember(const string& text) {
+  yielded_.insert(HashText(text));
 }
 
 // PrefetchTranslation
@@ -8,13 +8,14 @@
 #ifndef RIME_TRANSLATION_H_
 #define RIME_TRANSLATION_H_
 
+#include <stdint.h>
 #include <rime_api.h>
 #include <rime/candidate.h>
 #include <rime/common.h>
 
 namespace rime {
 
-class Translation {
+class Translation : public ArenaObject {
  public:
   Translation() = default;
   virtual ~Translation() = default;
@@ -32,6 +33,10 @@ class Translation {
 
   bool exhausted() const { return exhausted_; }
 
+  // whether work in the background was abandoned before the translation
+  // got its results; a menu holding such a translation is not to be reused.
+  virtual bool cancelled() const { return false; }
+
  protected:
   void set_exhausted(bool exhausted) { exhausted_ = exhausted; }
 
@@ -97,12 +102,24 @@ class MergedTranslation : public Translation {
 
   size_t size() const { return translations_.size(); }
 
+  bool cancelled() const override;
+
  protected:
   void Elect();
+  void Remove(size_t k);
+  void Invalidate(size_t k);
 
   const CandidateList& previous_candidates_;
   vector<of<Translation>> translations_;
+  // verdicts_[k] caches the result of comparing translation #k with #k+1.
+  // it stays valid until either of them advances or is removed.
+  vector<int> verdicts_;
   size_t elected_ = 0;
+  // a cancelled translation has been removed, its results missing.
+  bool lost_cancelled_ = false;
+  // election is deferred until a candidate is requested, so that adding a
+  // translation does not force it to produce candidates.
+  bool pending_election_ = false;
 };
 
 class CacheTranslation : public Translation {
@@ -129,8 +146,11 @@ class DistinctTranslation : public CacheTranslation {
 
  protected:
   bool AlreadyHas(const string& text) const;
+  void Remember(const string& text);
 
-  set<string> candidate_set_;
+  // hashes of the texts yielded. neither the candidates nor their texts
+  // are kept, nor the arenas they were allocated from.
+  hash_set<uint64_t> yielded_;
 };
 
 class PrefetchTranslation : public Translation {
@@ -219,6 +219,9 @@ RIME_API void RimeSetupLogging(const char* app_name);
  *   + session_id = 0, message_type="deploy", message_value="start"
  *   + session_id = 0, message_type="deploy", message_value="success"
  *   + session_id = 0, message_type="deploy", message_value="failure"
+ * - on a menu evaluated in the background (translator/async_compose):
+ *   + message_type="menu", message_value="ready"
+ *     sent from the background thread as soon as the menu is ready.
  *
  *   handler will be called with context_object as the first parameter
  *   every time an event occurs in librime, until RimeFinalize() is called.
@@ -388,6 +391,9 @@ typedef struct rime_api_t {
    *    + session_id = 0, message_type="deploy", message_value="start"
    *    + session_id = 0, message_type="deploy", message_value="success"
    *    + session_id = 0, message_type="deploy", message_value="failure"
+   *  - on a menu evaluated in the background (translator/async_compose):
+   *    + message_type="menu", message_value="ready"
+   *      sent from the background thread as soon as the menu is ready.
    *
    *  handler will be called with context_object as the first parameter
    *  every time an event occurs in librime, until RimeFinalize() is called.
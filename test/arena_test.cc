@@ -0,0 +1,75 @@
+//
+// Copyright RIME Developers
+// Distributed under the BSD License
+//
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <gtest/gtest.h>
+#include <rime/candidate.h>
+#include <rime/common.h>
+
+using namespace rime;
+
+TEST(RimeArenaTest, AllocateInBulk) {
+  auto arena = New<Arena>();
+  {
+    Arena::Scope scope(arena.get());
+    EXPECT_EQ(arena.get(), Arena::current());
+    arena_map<int, int> numbers;
+    for (int i = 0; i < 1000; ++i) {
+      numbers[i] = i;
+    }
+  }
+  EXPECT_EQ(nullptr, Arena::current());
+  EXPECT_EQ(1000, arena->num_allocations());
+  EXPECT_GE(arena->num_allocations() / 10, arena->num_blocks());
+}
+
+TEST(RimeArenaTest, EscapedCandidateOutlivesArena) {
+  an<Candidate> escaped;
+  {
+    auto arena = New<Arena>();
+    Arena::Scope scope(arena.get());
+    escaped = New<SimpleCandidate>("abc", 0, 3, "ABC");
+    EXPECT_EQ(1, arena->num_allocations());
+  }
+  ASSERT_TRUE(bool(escaped));
+  EXPECT_EQ("ABC", escaped->text());
+}
+
+TEST(RimeArenaTest, OtherThreadsAllocateFromChunksOfTheirOwn) {
+  auto arena = New<Arena>();
+  const int kNumThreads = 4;
+  const int kNumObjects = 1000;
+  vector<vector<uintptr_t>> addresses(kNumThreads);
+  vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([&arena, &addresses, t] {
+      for (int i = 0; i < kNumObjects; ++i) {
+        void* ptr = arena->Allocate(sizeof(double), alignof(double));
+        addresses[t].push_back(reinterpret_cast<uintptr_t>(ptr));
+        *static_cast<double*>(ptr) = t;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(kNumThreads * kNumObjects, arena->num_foreign_allocations());
+  EXPECT_EQ(kNumThreads * kNumObjects, arena->num_allocations());
+  EXPECT_GE(arena->num_allocations() / 10, arena->num_blocks());
+  // no two objects overlap
+  vector<uintptr_t> all;
+  for (const auto& a : addresses) {
+    for (uintptr_t address : a) {
+      EXPECT_EQ(0, address % alignof(double));
+      all.push_back(address);
+    }
+  }
+  std::sort(all.begin(), all.end());
+  for (size_t i = 1; i < all.size(); ++i) {
+    EXPECT_GE(all[i] - all[i - 1], sizeof(double));
+  }
+}
@@ -4,8 +4,11 @@
 //
 // 2011-07-05 GONG Chen <chen.sst@gmail.com>
 //
+#include <algorithm>
+#include <random>
 #include <gtest/gtest.h>
 #include <rime/common.h>
+#include <rime/menu.h>
 #include <rime/algo/encoder.h>
 #include <rime/algo/syllabifier.h>
 #include <rime/dict/dictionary.h>
@@ -102,4 +105,285 @@ TEST_F(RimeDictionaryTest, ScriptLookup) {
   EXPECT_EQ(3, e3->code.size());
   EXPECT_EQ(9, e3->text.length());
   EXPECT_FALSE(d7.Next());
+
+  // the syllables taken in the graph are recorded with the entries
+  ASSERT_EQ(1, e1->path.size());
+  EXPECT_EQ(3, e1->path[0].end_pos);
+  ASSERT_EQ(2, e2->path.size());
+  EXPECT_EQ(3, e2->path[0].end_pos);
+  EXPECT_EQ(5, e2->path[1].end_pos);
+  ASSERT_EQ(3, e3->path.size());
+  EXPECT_EQ(5, e3->path[1].end_pos);
+  EXPECT_EQ(7, e3->path[2].end_pos);
+  for (const auto& step : e3->path) {
+    EXPECT_FALSE(step.is_correction);
+  }
+}
+
+TEST_F(RimeDictionaryTest, ScriptLookupAll) {
+  ASSERT_TRUE(dict_->loaded());
+  rime::SyllableGraph g;
+  rime::Syllabifier s;
+  rime::string input("shurufa");
+  ASSERT_TRUE(s.BuildSyllableGraph(input, *dict_->prism(), &g) > 0);
+  auto c0 = dict_->Lookup(g, 0);
+  ASSERT_TRUE(bool(c0));
+  std::map<size_t, rime::an<rime::DictEntryCollector>> results;
+  results[0] = c0;
+  dict_->LookupAll(g, &results);
+  // the given result is kept as is
+  EXPECT_EQ(c0, results[0]);
+  for (const auto& x : g.edges) {
+    ASSERT_TRUE(results.find(x.first) != results.end());
+    auto expected = dict_->Lookup(g, x.first);
+    auto actual = results[x.first];
+    ASSERT_EQ(bool(expected), bool(actual));
+    if (!expected)
+      continue;
+    ASSERT_EQ(expected->size(), actual->size());
+    for (auto& y : *expected) {
+      ASSERT_TRUE(actual->find(y.first) != actual->end());
+      // a copy iterates on its own
+      rime::DictEntryIterator copy((*actual)[y.first]);
+      for (auto& a = y.second; !a.exhausted(); a.Next()) {
+        ASSERT_FALSE(copy.exhausted());
+        EXPECT_EQ(a.Peek()->text, copy.Peek()->text);
+        copy.Next();
+      }
+      EXPECT_TRUE(copy.exhausted());
+      EXPECT_FALSE((*actual)[y.first].exhausted());
+    }
+  }
+}
+
+// adds an entry of more syllables than indexed to the vocabulary.
+static void AddLongEntry(rime::Vocabulary* voc,
+                         const rime::Code& code,
+                         const rime::string& text) {
+  auto e = rime::New<rime::DictEntry>();
+  e->code = code;
+  e->text = text;
+  e->weight = 1.0;
+  rime::Vocabulary* level = voc;
+  for (size_t i = 0; i < rime::Code::kIndexCodeMaxLength; ++i) {
+    auto& next_level = (*level)[code[i]].next_level;
+    if (!next_level)
+      next_level = rime::New<rime::Vocabulary>();
+    level = next_level.get();
+  }
+  (*level)[-1].entries.push_back(e);
+}
+
+TEST(RimeDictionaryTailTest, SortedTailMatchesExtraCode) {
+  const int kNumSyllables = 3;
+  const size_t kInputLength = 12;
+  std::mt19937 rng(34);
+  rime::Syllabary syllabary;
+  for (int i = 0; i < kNumSyllables; ++i) {
+    syllabary.insert(std::to_string(i));
+  }
+  // all long entries share the index code {0, 1, 2}, so that they are
+  // found in one tail index.
+  rime::Vocabulary voc;
+  std::uniform_int_distribution<int> syllable(0, kNumSyllables - 1);
+  std::uniform_int_distribution<int> extra_length(1, 5);
+  const size_t kNumEntries = 300;
+  for (size_t i = 0; i < kNumEntries; ++i) {
+    rime::Code code;
+    for (int k = 0; k < 3; ++k) {
+      code.push_back(k);
+    }
+    for (int k = extra_length(rng); k > 0; --k) {
+      code.push_back(syllable(rng));
+    }
+    AddLongEntry(&voc, code, std::to_string(i));
+  }
+  rime::Table table("dictionary_tail_test.table.bin");
+  table.Remove();
+  ASSERT_TRUE(table.Build(syllabary, voc, kNumEntries));
+  ASSERT_TRUE(table.Save());
+  ASSERT_TRUE(table.Load());
+  ASSERT_TRUE(table.sorted_tail());
+
+  // each syllable may span one or two characters, so that entries are
+  // matched along paths ending at different positions.
+  rime::SyllableGraph g;
+  g.input_length = g.interpreted_length = kInputLength;
+  std::bernoulli_distribution coin(0.5);
+  for (size_t pos = 0; pos < kInputLength; ++pos) {
+    g.vertices[pos] = rime::kNormalSpelling;
+    for (int id = 0; id < kNumSyllables; ++id) {
+      for (size_t end = pos + 1; end <= (std::min)(pos + 2, kInputLength);
+           ++end) {
+        // the index code is taken one character at a time
+        bool in_index_code = pos < 3 && id == static_cast<int>(pos);
+        if (in_index_code ? end != pos + 1 : !coin(rng))
+          continue;
+        auto& props = g.edges[pos][end][id];
+        props.type = rime::kNormalSpelling;
+        props.end_pos = end;
+        props.is_correction = coin(rng);
+        g.indices[pos][id].push_back(&props);
+      }
+    }
+  }
+  g.vertices[kInputLength] = rime::kNormalSpelling;
+
+  rime::TableQueryResult result;
+  ASSERT_TRUE(table.Query(g, 0, &result));
+  ASSERT_TRUE(result.has(3));
+  size_t num_tails = 0;
+  for (auto& a : result.at(3)) {
+    if (!a.extra_code())
+      continue;
+    ++num_tails;
+    const rime::table::LongEntry* entries = a.long_entries();
+    size_t num_entries = a.remaining();
+    rime::SyllablePath index_path(a.path(),
+                                  a.path() + a.index_code().size());
+    std::vector<rime::dictionary::TailMatch> expected;
+    for (size_t i = 0; i < num_entries; ++i) {
+      rime::SyllablePath path(index_path);
+      size_t end_pos = rime::dictionary::match_extra_code(
+          &entries[i].extra_code, 0, g, 3, &path);
+      if (end_pos)
+        expected.push_back({i, end_pos, path});
+    }
+    std::vector<rime::dictionary::TailMatch> actual;
+    rime::dictionary::match_sorted_tail(entries, num_entries, g, 3,
+                                        index_path, &actual);
+    ASSERT_GT(expected.size(), 0);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t k = 0; k < expected.size(); ++k) {
+      EXPECT_EQ(expected[k].index, actual[k].index);
+      EXPECT_EQ(expected[k].end_pos, actual[k].end_pos);
+      ASSERT_EQ(expected[k].path.size(), actual[k].path.size());
+      for (size_t j = 0; j < expected[k].path.size(); ++j) {
+        EXPECT_EQ(expected[k].path[j].end_pos, actual[k].path[j].end_pos);
+        EXPECT_EQ(expected[k].path[j].is_correction,
+                  actual[k].path[j].is_correction);
+      }
+    }
+  }
+  EXPECT_EQ(1, num_tails);
+  table.Close();
+}
+
+// looks up the input typed so far, keystroke by keystroke, in the arena of
+// a new menu each time; returns the arenas.
+static std::vector<rime::an<rime::Arena>> LookupTyping(
+    rime::Dictionary* dict, const rime::string& input) {
+  std::vector<rime::an<rime::Arena>> arenas;
+  for (size_t length = 1; length <= input.length(); ++length) {
+    rime::Menu menu;
+    {
+      rime::Arena::Scope scope(menu.arena());
+      rime::SyllableGraph g;
+      rime::Syllabifier s;
+      s.BuildSyllableGraph(input.substr(0, length), *dict->prism(), &g);
+      if (auto collector = dict->Lookup(g, 0)) {
+        for (auto& x : *collector) {
+          for (auto& it = x.second; !it.exhausted(); it.Next()) {
+            it.Peek();
+          }
+        }
+      }
+    }
+    arenas.push_back(menu.arena()->shared_from_this());
+  }
+  return arenas;
+}
+
+TEST_F(RimeDictionaryTest, ArenaAllocationsPerKeystroke) {
+  ASSERT_TRUE(dict_->loaded());
+  size_t num_objects = 0;
+  size_t num_blocks = 0;
+  for (const auto& arena : LookupTyping(dict_.get(), "shurufa")) {
+    EXPECT_GT(arena->num_allocations(), 0);
+    EXPECT_EQ(0, arena->num_foreign_allocations());
+    // one block to start with, one more for every ten objects at most.
+    EXPECT_LE(arena->num_blocks(), 1 + arena->num_allocations() / 10);
+    num_objects += arena->num_allocations();
+    num_blocks += arena->num_blocks();
+  }
+  // syllable graphs and entries are served from the menus' arenas, which
+  // call the system allocator an order of magnitude less often.
+  EXPECT_GE(num_objects, 10 * num_blocks);
+}
+
+TEST(RimeDictionaryMergeTest, PredictiveLookupInMergedOrder) {
+  // a primary table and a pack, with more homophones than merged at a time
+  const rime::Syllabary syllabary{"a", "ab", "abc", "b"};
+  std::mt19937 rng(2024);
+  std::uniform_real_distribution<double> weight(0.0, 100.0);
+  std::vector<rime::of<rime::Table>> tables;
+  size_t total_num_entries = 0;
+  for (const char* name : {"dictionary_merge_test.table.bin",
+                           "dictionary_merge_pack.table.bin"}) {
+    rime::Vocabulary vocabulary;
+    size_t num_entries = 0;
+    for (int syllable_id = 0; syllable_id < 3; ++syllable_id) {
+      std::vector<double> weights(20 + 30 * syllable_id);
+      for (auto& w : weights) {
+        w = weight(rng);
+      }
+      std::sort(weights.rbegin(), weights.rend());
+      for (double w : weights) {
+        auto e = rime::New<rime::DictEntry>();
+        e->code.push_back(syllable_id);
+        e->text = std::to_string(num_entries++);
+        e->weight = w;
+        vocabulary[syllable_id].entries.push_back(e);
+      }
+    }
+    auto table = rime::New<rime::Table>(name);
+    table->Remove();
+    ASSERT_TRUE(table->Build(syllabary, vocabulary, num_entries));
+    ASSERT_TRUE(table->Save());
+    tables.push_back(table);
+    total_num_entries += num_entries;
+  }
+  auto prism = rime::New<rime::Prism>("dictionary_merge_test.prism.bin");
+  prism->Remove();
+  ASSERT_TRUE(prism->Build(syllabary));
+  ASSERT_TRUE(prism->Save());
+  rime::Dictionary dict("dictionary_merge_test", {"dictionary_merge_pack"},
+                        tables, prism);
+  ASSERT_TRUE(dict.Load());
+
+  rime::DictEntryIterator it;
+  dict.LookupWords(&it, "a", true);
+  EXPECT_EQ(total_num_entries, it.entry_count());
+  size_t count = 0;
+  size_t last_length = 0;
+  double last_weight = 0.0;
+  for (; !it.exhausted(); it.Next(), ++count) {
+    auto e = it.Peek();
+    if (count > 0 && e->remaining_code_length == last_length) {
+      EXPECT_LE(e->weight, last_weight) << "entry #" << count;
+    }
+    else {
+      EXPECT_GE(e->remaining_code_length, last_length);
+    }
+    last_length = e->remaining_code_length;
+    last_weight = e->weight;
+  }
+  EXPECT_EQ(total_num_entries, count);
+
+  // skipping follows the same order
+  rime::DictEntryIterator skipped;
+  dict.LookupWords(&skipped, "a", true);
+  rime::DictEntryIterator walked;
+  dict.LookupWords(&walked, "a", true);
+  const size_t kNumSkipped = 45;
+  ASSERT_TRUE(skipped.Skip(kNumSkipped));
+  for (size_t i = 0; i < kNumSkipped; ++i) {
+    walked.Next();
+  }
+  EXPECT_EQ(walked.Peek()->text, skipped.Peek()->text);
+
+  for (auto& table : tables) {
+    table->Remove();
+  }
+  prism->Remove();
 }
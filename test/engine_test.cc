@@ -0,0 +1,184 @@
+//
+// Copyright RIME Developers
+// Distributed under the BSD License
+//
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <rime/candidate.h>
+#include <rime/common.h>
+#include <rime/component.h>
+#include <rime/composition.h>
+#include <rime/config.h>
+#include <rime/context.h>
+#include <rime/engine.h>
+#include <rime/menu.h>
+#include <rime/registry.h>
+#include <rime/schema.h>
+#include <rime/segmentation.h>
+#include <rime/segmentor.h>
+#include <rime/ticket.h>
+#include <rime/translation.h>
+#include <rime/translator.h>
+
+using namespace rime;
+
+// segments the input two characters at a time.
+class PairSegmentor : public Segmentor {
+ public:
+  explicit PairSegmentor(const Ticket& ticket) : Segmentor(ticket) {}
+
+  bool Proceed(Segmentation* segmentation) {
+    size_t start = segmentation->GetCurrentStartPosition();
+    size_t end = (std::min)(start + 2, segmentation->input().length());
+    if (start < end) {
+      Segment segment(start, end);
+      segment.tags.insert("abc");
+      segmentation->AddSegment(segment);
+    }
+    return true;
+  }
+};
+
+// stands for a translation with work in the background.
+class PendingTranslation : public UniqueTranslation {
+ public:
+  PendingTranslation(an<Candidate> candidate, an<bool> cancelled)
+      : UniqueTranslation(candidate), cancelled_(cancelled) {}
+
+  bool cancelled() const override { return *cancelled_; }
+
+ private:
+  an<bool> cancelled_;
+};
+
+// records the queries and keeps a cancellation flag for each.
+class CountingTranslator : public Translator {
+ public:
+  explicit CountingTranslator(const Ticket& ticket) : Translator(ticket) {}
+
+  an<Translation> Query(const string& input, const Segment& segment) {
+    queries.push_back(input);
+    auto flag = New<bool>(false);
+    cancelled[segment.start] = flag;
+    return New<PendingTranslation>(
+        New<SimpleCandidate>("test", segment.start, segment.end, input),
+        flag);
+  }
+
+  static vector<string> queries;
+  static map<size_t, an<bool>> cancelled;
+};
+
+vector<string> CountingTranslator::queries;
+map<size_t, an<bool>> CountingTranslator::cancelled;
+
+class RimeEngineTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    Registry& r = Registry::instance();
+    r.Register("pair_segmentor", new Component<PairSegmentor>);
+    r.Register("counting_translator", new Component<CountingTranslator>);
+    CountingTranslator::queries.clear();
+    CountingTranslator::cancelled.clear();
+
+    engine_.reset(Engine::Create());
+    Config* config = new Config;
+    auto segmentors = New<ConfigList>();
+    segmentors->Append(New<ConfigValue>("pair_segmentor"));
+    config->SetItem("engine/segmentors", segmentors);
+    auto translators = New<ConfigList>();
+    translators->Append(New<ConfigValue>("counting_translator"));
+    config->SetItem("engine/translators", translators);
+    engine_->ApplySchema(new Schema("engine_test", config));
+  }
+
+  void TearDown() override {
+    engine_.reset();
+    Registry& r = Registry::instance();
+    r.Unregister("pair_segmentor");
+    r.Unregister("counting_translator");
+  }
+
+  const Segment& segment(size_t index) const {
+    return engine_->context()->composition()[index];
+  }
+
+  the<Engine> engine_;
+};
+
+TEST_F(RimeEngineTest, KeepMenusOfUnchangedSegments) {
+  Context* ctx = engine_->context();
+  ctx->PushInput("abcd");
+  ASSERT_EQ(2, ctx->composition().size());
+  an<Menu> ab = segment(0).menu;
+  an<Menu> cd = segment(1).menu;
+  CountingTranslator::queries.clear();
+
+  ctx->PushInput('e');
+  ASSERT_EQ(3, ctx->composition().size());
+  // only the new segment is translated
+  ASSERT_EQ(1, CountingTranslator::queries.size());
+  EXPECT_EQ("e", CountingTranslator::queries[0]);
+  EXPECT_EQ(ab, segment(0).menu);
+  EXPECT_EQ(cd, segment(1).menu);
+}
+
+// selects "ab", then types "cdef" and returns to the selection, so that the
+// segment after the caret is segmented again.
+static void ReturnToSelection(Context* ctx) {
+  ctx->PushInput("ab");
+  ASSERT_TRUE(ctx->Select(0));
+  ctx->PushInput("cdef");
+  ASSERT_EQ(3, ctx->composition().size());
+}
+
+TEST_F(RimeEngineTest, ReuseStashedMenus) {
+  Context* ctx = engine_->context();
+  ReturnToSelection(ctx);
+  an<Menu> cd = segment(1).menu;
+  CountingTranslator::queries.clear();
+
+  ctx->set_caret_pos(2);
+  ASSERT_EQ(2, ctx->composition().size());
+  EXPECT_LE(Segment::kSelected, segment(0).status);
+  EXPECT_TRUE(CountingTranslator::queries.empty());
+  EXPECT_EQ(cd, segment(1).menu);
+  auto candidate = segment(1).menu->GetCandidateAt(0);
+  ASSERT_TRUE(bool(candidate));
+  EXPECT_EQ("cd", candidate->text());
+}
+
+TEST_F(RimeEngineTest, InvalidateStashedMenusOfCancelledWork) {
+  Context* ctx = engine_->context();
+  ReturnToSelection(ctx);
+  an<Menu> cd = segment(1).menu;
+  *CountingTranslator::cancelled[2] = true;
+  EXPECT_TRUE(cd->cancelled());
+  CountingTranslator::queries.clear();
+
+  ctx->set_caret_pos(2);
+  ASSERT_EQ(2, ctx->composition().size());
+  ASSERT_EQ(1, CountingTranslator::queries.size());
+  EXPECT_EQ("cd", CountingTranslator::queries[0]);
+  EXPECT_NE(cd, segment(1).menu);
+  EXPECT_FALSE(segment(1).menu->cancelled());
+}
+
+TEST_F(RimeEngineTest, InvalidateKeptMenusOfCancelledWork) {
+  Context* ctx = engine_->context();
+  ctx->PushInput("abcd");
+  ASSERT_EQ(2, ctx->composition().size());
+  an<Menu> ab = segment(0).menu;
+  an<Menu> cd = segment(1).menu;
+  *CountingTranslator::cancelled[2] = true;
+  CountingTranslator::queries.clear();
+
+  ctx->PushInput('e');
+  ASSERT_EQ(3, ctx->composition().size());
+  ASSERT_EQ(2, CountingTranslator::queries.size());
+  EXPECT_EQ("cd", CountingTranslator::queries[0]);
+  EXPECT_EQ("e", CountingTranslator::queries[1]);
+  EXPECT_EQ(ab, segment(0).menu);
+  EXPECT_NE(cd, segment(1).menu);
+  EXPECT_FALSE(segment(1).menu->cancelled());
+}
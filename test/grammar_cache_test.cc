@@ -0,0 +1,118 @@
+//
+// Copyright RIME Developers
+// Distributed under the BSD License
+//
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <gtest/gtest.h>
+#include <rime/common.h>
+#include <rime/gear/grammar.h>
+#include <rime/gear/grammar_cache.h>
+
+using namespace rime;
+
+// scores each query differently, and counts the queries made through it.
+class FakeGrammar : public Grammar {
+ public:
+  double Query(const string& context,
+               const string& word,
+               bool is_rear) override {
+    ++num_queries;
+    return -double(context.length() * 100 + word.length()) -
+        (is_rear ? 0.5 : 0.0);
+  }
+
+  int num_queries = 0;
+};
+
+class RimeGrammarCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    grammar_ = new FakeGrammar;
+    cache_.reset(new GrammarCache(the<Grammar>(grammar_)));
+  }
+
+  FakeGrammar* grammar_;
+  the<GrammarCache> cache_;
+};
+
+static const char* kWords[] = {"a", "bb", "ccc", "dddd", "eeeee"};
+
+TEST_F(RimeGrammarCacheTest, CachedValuesEqualUncached) {
+  FakeGrammar uncached;
+  for (int round = 0; round < 3; ++round) {
+    for (const char* context : kWords) {
+      for (const char* word : kWords) {
+        EXPECT_EQ(uncached.Query(context, word, false),
+                  cache_->Query(context, word, false));
+      }
+    }
+  }
+  // queried once, then served from the cache
+  EXPECT_EQ(25, grammar_->num_queries);
+  EXPECT_EQ(75, cache_->num_queries());
+  EXPECT_EQ(50, cache_->num_hits());
+}
+
+TEST_F(RimeGrammarCacheTest, IsRearIsPartOfKey) {
+  double front = cache_->Query("a", "bb", false);
+  double rear = cache_->Query("a", "bb", true);
+  EXPECT_EQ(2, grammar_->num_queries);
+  EXPECT_NE(front, rear);
+  EXPECT_EQ(front, cache_->Query("a", "bb", false));
+  EXPECT_EQ(rear, cache_->Query("a", "bb", true));
+  EXPECT_EQ(2, grammar_->num_queries);
+  EXPECT_EQ(2, cache_->num_hits());
+}
+
+TEST_F(RimeGrammarCacheTest, HitRate) {
+  EXPECT_EQ(0.0, cache_->hit_rate());
+  cache_->Query("a", "bb", false);
+  EXPECT_EQ(0, cache_->num_hits());
+  EXPECT_EQ(0.0, cache_->hit_rate());
+  cache_->Query("a", "bb", false);
+  cache_->Query("a", "bb", false);
+  cache_->Query("a", "ccc", false);
+  EXPECT_EQ(4, cache_->num_queries());
+  EXPECT_EQ(2, cache_->num_hits());
+  EXPECT_DOUBLE_EQ(0.5, cache_->hit_rate());
+}
+
+// detects queries made at the same time, which it does not support.
+class SingleThreadedGrammar : public Grammar {
+ public:
+  double Query(const string& context,
+               const string& word,
+               bool is_rear) override {
+    int active = ++num_active;
+    int peak = max_active;
+    while (active > peak && !max_active.compare_exchange_weak(peak, active)) {
+    }
+    std::this_thread::yield();
+    --num_active;
+    return -double(context.length() + word.length());
+  }
+
+  std::atomic<int> num_active{0};
+  std::atomic<int> max_active{0};
+};
+
+TEST(RimeGrammarCacheThreadTest, SerializesQueriesToUnsafeGrammar) {
+  auto* grammar = new SingleThreadedGrammar;
+  GrammarCache cache{the<Grammar>(grammar)};
+  EXPECT_FALSE(cache.thread_safe());
+  vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&cache, t] {
+      for (int i = 0; i < 2000; ++i) {
+        // mostly missing the cache
+        cache.Query(std::to_string(t), std::to_string(i), false);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(1, grammar->max_active);
+}
@@ -0,0 +1,164 @@
+//
+// Copyright RIME Developers
+// Distributed under the BSD License
+//
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <gtest/gtest.h>
+#include <rime/common.h>
+#include <rime/dict/ngram_model.h>
+
+using namespace rime;
+
+class RimeNgramModelTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    model_.reset(new NgramModel("ngram_model_test.ngram.bin"));
+    model_->Remove();
+    vector<ngram::Count> counts = {
+      {{"\xe4\xbd\xa0"}, 100},  // 你
+      {{"\xe4\xbd\xa0", "\xe5\xa5\xbd"}, 50},  // 你 好
+      {{"\xe4\xbd\xa0", "\xe4\xbb\xac"}, 25},  // 你 们
+      // the context 我们 is not counted by itself
+      {{"\xe6\x88\x91", "\xe4\xbb\xac", "\xe5\xa5\xbd"}, 3},  // 我 们 好
+      {{"\xe6\x88\x91", "\xe4\xbb\xac", "\xe7\x9a\x84"}, 1},  // 我 们 的
+    };
+    ASSERT_TRUE(model_->Build(counts));
+    ASSERT_TRUE(model_->Save());
+  }
+
+  void TearDown() override {
+    model_.reset();
+  }
+
+  the<NgramModel> model_;
+};
+
+TEST_F(RimeNgramModelTest, Query) {
+  EXPECT_EQ(4, model_->num_ngrams());
+  EXPECT_EQ(2, model_->max_context_length());
+  EXPECT_TRUE(model_->Verify());
+  const double kTolerance = 0.01;
+  double score = 0.0;
+  // the context is matched against the end of the text
+  ASSERT_TRUE(model_->Query("\xe8\xaf\xb4\xe4\xbd\xa0",  // 说你
+                            "\xe5\xa5\xbd", 1, 4, &score));
+  EXPECT_NEAR(std::log(0.5), score, kTolerance);
+  ASSERT_TRUE(model_->Query("\xe4\xbd\xa0", "\xe4\xbb\xac", 1, 4, &score));
+  EXPECT_NEAR(std::log(0.25), score, kTolerance);
+  // the longest context wins
+  ASSERT_TRUE(model_->Query("\xe6\x88\x91\xe4\xbb\xac",  // 我们
+                            "\xe5\xa5\xbd", 1, 4, &score));
+  EXPECT_NEAR(std::log(0.75), score, kTolerance);
+  EXPECT_FALSE(model_->Query("\xe6\x88\x91\xe4\xbb\xac",
+                             "\xe5\xa5\xbd", 1, 1, &score));
+  EXPECT_FALSE(model_->Query("\xe4\xbd\xa0", "\xe5\xa5\xbd", 2, 4, &score));
+  EXPECT_FALSE(model_->Query("", "\xe5\xa5\xbd", 1, 4, &score));
+  EXPECT_FALSE(model_->Query("\xe4\xbd\xa0", "\xe7\x9a\x84", 1, 4, &score));
+}
+
+TEST_F(RimeNgramModelTest, Reload) {
+  NgramModel model("ngram_model_test.ngram.bin");
+  ASSERT_TRUE(model.Load());
+  EXPECT_TRUE(model.Verify());
+  double score = 0.0;
+  ASSERT_TRUE(model.Query("\xe4\xbd\xa0", "\xe5\xa5\xbd", 1, 4, &score));
+  EXPECT_NEAR(std::log(0.5), score, 0.01);
+}
+
+// synthetic bigrams and trigrams, and queries half of which are counted.
+class RimeNgramModelSyntheticTest : public ::testing::Test {
+ protected:
+  static const int kNumWords = 2000;
+  static const int kNumNgrams = 100000;
+
+  void SetUp() override {
+    std::mt19937 rng(44);
+    std::uniform_int_distribution<int> pick(0, kNumWords - 1);
+    vector<ngram::Count> counts;
+    for (int i = 0; i < kNumWords; ++i) {
+      counts.push_back({{word(i)}, double(1000 + pick(rng))});
+    }
+    for (int i = 0; i < kNumNgrams; ++i) {
+      if (i % 4 == 0) {
+        counts.push_back({{word(pick(rng)), word(pick(rng)), word(pick(rng))},
+                          double(1 + pick(rng) % 10)});
+      }
+      else {
+        counts.push_back({{word(pick(rng)), word(pick(rng))},
+                          double(1 + pick(rng) % 100)});
+      }
+    }
+    model_.reset(new NgramModel("ngram_model_benchmark.ngram.bin"));
+    model_->Remove();
+    ASSERT_TRUE(model_->Build(counts));
+    ASSERT_TRUE(model_->Save());
+
+    for (int i = 0; i < 1000; ++i) {
+      const auto& x = counts[kNumWords + pick(rng) * kNumNgrams / kNumWords];
+      string context;
+      for (size_t j = 0; j + 1 < x.words.size(); ++j)
+        context += x.words[j];
+      counted_queries_.emplace_back(context, x.words.back());
+      queries_.emplace_back(context, x.words.back());
+      queries_.emplace_back(word(pick(rng)) + word(pick(rng)),
+                            word(pick(rng)));
+    }
+  }
+
+  void TearDown() override {
+    model_->Remove();
+    model_.reset();
+  }
+
+  // two CJK characters per word
+  static string word(int i) {
+    string w;
+    for (int c : {0x4e00 + i % 1000, 0x4e00 + 1000 + i / 1000}) {
+      w += static_cast<char>(0xe0 | (c >> 12));
+      w += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+      w += static_cast<char>(0x80 | (c & 0x3f));
+    }
+    return w;
+  }
+
+  the<NgramModel> model_;
+  vector<pair<string, string>> counted_queries_;
+  vector<pair<string, string>> queries_;
+};
+
+TEST_F(RimeNgramModelSyntheticTest, QueryCountedNgrams) {
+  EXPECT_TRUE(model_->Verify());
+  EXPECT_LE(model_->num_ngrams(), kNumNgrams);
+  double score = 0.0;
+  for (const auto& q : counted_queries_) {
+    ASSERT_TRUE(model_->Query(q.first, q.second, 1, 4, &score))
+        << q.first << " " << q.second;
+    EXPECT_LE(score, 0.0);
+  }
+}
+
+// timing only; run with --gtest_also_run_disabled_tests.
+TEST_F(RimeNgramModelSyntheticTest, DISABLED_QueryThroughput) {
+  const int kRounds = 200;
+  size_t hits = 0;
+  double score = 0.0;
+  auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < kRounds; ++round) {
+    for (const auto& q : queries_) {
+      hits += model_->Query(q.first, q.second, 1, 4, &score);
+    }
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  size_t num_queries = kRounds * queries_.size();
+  EXPECT_GE(hits, num_queries / 2);
+  std::cout << model_->num_ngrams() << " n-grams in "
+            << model_->file_size() << " bytes ("
+            << double(model_->file_size()) / model_->num_ngrams()
+            << " bytes per n-gram); "
+            << num_queries / elapsed.count() << " queries per second."
+            << std::endl;
+}
@@ -0,0 +1,842 @@
+//
+// Copyright RIME Developers
+// Distributed under the BSD License
+//
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <gtest/gtest.h>
+#include <rime/candidate.h>
+#include <rime/common.h>
+#include <rime/config.h>
+#include <rime/registry.h>
+#include <rime/gear/grammar.h>
+#include <rime/gear/ngram_grammar.h>
+#include <rime/gear/poet.h>
+
+using namespace rime;
+
+// scores every word the same, so that lines are ranked by entry weights.
+class FlatGrammar : public Grammar {
+ public:
+  double Query(const string& context,
+               const string& word,
+               bool is_rear) override {
+    return 0.0;
+  }
+};
+
+class FlatGrammarComponent : public Grammar::Component {
+ public:
+  Grammar* Create(Config* config) override { return new FlatGrammar; }
+};
+
+// scores a word by a hash of the context and the word, so that lines of
+// the same entry weights differ.
+class HashGrammar : public Grammar {
+ public:
+  double Query(const string& context,
+               const string& word,
+               bool is_rear) override {
+    return -double(std::hash<string>()(context + "|" + word) % 16) / 4.0;
+  }
+  // it keeps no state.
+  bool thread_safe() const override { return true; }
+};
+
+class HashGrammarComponent : public Grammar::Component {
+ public:
+  Grammar* Create(Config* config) override { return new HashGrammar; }
+};
+
+// counts the queries made through it. the scores are finely grained, so
+// that lines of equal weights are not likely.
+class CountingGrammar : public Grammar {
+ public:
+  double Query(const string& context,
+               const string& word,
+               bool is_rear) override {
+    ++num_queries;
+    return -double(std::hash<string>()(context + "|" + word) % 65536) / 4096.0;
+  }
+
+  static size_t num_queries;
+};
+
+size_t CountingGrammar::num_queries = 0;
+
+class CountingGrammarComponent : public Grammar::Component {
+ public:
+  Grammar* Create(Config* config) override { return new CountingGrammar; }
+};
+
+class RimePoetTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    Registry::instance().Register("grammar", new FlatGrammarComponent);
+  }
+  void TearDown() override {
+    Registry::instance().Register("grammar", new NgramGrammarComponent);
+  }
+
+  static void AddEntry(WordGraph* graph, int start, int end,
+                       const string& text, double weight) {
+    auto e = New<DictEntry>();
+    e->text = text;
+    e->weight = weight;
+    (*graph)[start][end].push_back(e);
+  }
+};
+
+TEST_F(RimePoetTest, TopSentences) {
+  WordGraph graph;
+  AddEntry(&graph, 0, 1, "a", -1.0);
+  AddEntry(&graph, 0, 2, "ab", -1.0);
+  AddEntry(&graph, 1, 2, "b", -1.0);
+  AddEntry(&graph, 2, 3, "c", -1.0);
+  AddEntry(&graph, 2, 4, "cd", -1.0);
+  AddEntry(&graph, 3, 4, "d", -1.0);
+  AddEntry(&graph, 3, 4, "D", -3.0);
+  Poet poet(nullptr, nullptr);
+  auto best = poet.MakeSentence(graph, 4, "");
+  ASSERT_TRUE(bool(best));
+  EXPECT_EQ("abcd", best->text());
+
+  auto translation = poet.MakeSentences(graph, 4, "", 7);
+  ASSERT_TRUE(bool(translation));
+  vector<an<Sentence>> sentences;
+  for (; !translation->exhausted(); translation->Next()) {
+    sentences.push_back(As<Sentence>(translation->Peek()));
+  }
+  // ab|c|d repeats the text of ab|cd, and is skipped
+  ASSERT_EQ(2, sentences.size());
+  EXPECT_EQ(best->text(), sentences[0]->text());
+  EXPECT_EQ(best->weight(), sentences[0]->weight());
+  EXPECT_EQ("abcD", sentences[1]->text());
+  EXPECT_GT(sentences[0]->weight(), sentences[1]->weight());
+  EXPECT_EQ(3, sentences[1]->components().size());
+
+  EXPECT_FALSE(bool(poet.MakeSentences(graph, 4, "", 0)));
+}
+
+struct Path {
+  string text;
+  double weight;
+};
+
+// all the paths through the graph but a single word, by brute force.
+static void FindPaths(const WordGraph& graph, int pos, int total_length,
+                      Path path, vector<Path>* paths) {
+  if (pos == total_length) {
+    paths->push_back(path);
+    return;
+  }
+  auto edges = graph.find(pos);
+  if (edges == graph.end())
+    return;
+  const double kPenalty = -18.420680743952367;  // as without a grammar
+  for (const auto& ev : edges->second) {
+    if (pos == 0 && ev.first == total_length)
+      continue;
+    for (const auto& entry : ev.second) {
+      FindPaths(graph, ev.first, total_length,
+                {path.text + entry->text,
+                 path.weight + (entry->weight + kPenalty)},
+                paths);
+    }
+  }
+}
+
+// without a grammar, the sentences made are the best paths through the
+// whole word graph.
+TEST_F(RimePoetTest, TopSentencesWithoutGrammar) {
+  Registry::instance().Unregister("grammar");
+  const int kLength = 8;
+  const size_t kMaxSentences = 10;
+  std::mt19937 rng(46);
+  std::uniform_real_distribution<double> weight(-8.0, -2.0);
+  for (int round = 0; round < 20; ++round) {
+    WordGraph graph;
+    for (int start = 0; start < kLength; ++start) {
+      for (int len = 1; len <= 3 && start + len <= kLength; ++len) {
+        for (int i = rng() % 3; i >= 0; --i) {
+          // the text of a path tells the words it is made of
+          AddEntry(&graph, start, start + len,
+                   std::to_string(start) + "-" + std::to_string(len) + "-" +
+                   std::to_string(i) + "|",
+                   weight(rng));
+        }
+      }
+    }
+    vector<Path> paths;
+    FindPaths(graph, 0, kLength, {"", 0.0}, &paths);
+    std::stable_sort(paths.begin(), paths.end(),
+                     [](const Path& a, const Path& b) {
+                       return a.weight > b.weight;
+                     });
+    ASSERT_GE(paths.size(), kMaxSentences);
+    for (auto compare : {Poet::CompareWeight, Poet::LeftAssociateCompare}) {
+      Poet poet(nullptr, nullptr, compare);
+      auto translation = poet.MakeSentences(graph, kLength, "", kMaxSentences);
+      ASSERT_TRUE(bool(translation));
+      for (size_t i = 0; i < kMaxSentences; ++i) {
+        ASSERT_FALSE(translation->exhausted());
+        auto sentence = As<Sentence>(translation->Peek());
+        EXPECT_EQ(paths[i].text, sentence->text());
+        EXPECT_NEAR(paths[i].weight, sentence->weight(), 1e-9);
+        translation->Next();
+      }
+      EXPECT_TRUE(translation->exhausted());
+    }
+  }
+}
+
+TEST_F(RimePoetTest, WorkBudget) {
+  WordGraph graph;
+  AddEntry(&graph, 0, 1, "a", -1.0);
+  AddEntry(&graph, 0, 2, "ab", -1.0);
+  AddEntry(&graph, 1, 2, "b", -3.0);
+  AddEntry(&graph, 2, 3, "c", -1.0);
+  AddEntry(&graph, 2, 3, "C", 0.0);
+  Poet unlimited(nullptr, nullptr);
+  auto sentence = unlimited.MakeSentence(graph, 3, "");
+  ASSERT_TRUE(bool(sentence));
+  EXPECT_EQ("abC", sentence->text());
+
+  Config config;
+  // only the first entry on each edge is taken
+  config.SetInt("poet/max_entries_per_edge", 1);
+  Poet first_entries(nullptr, &config);
+  sentence = first_entries.MakeSentence(graph, 3, "");
+  ASSERT_TRUE(bool(sentence));
+  EXPECT_EQ("abc", sentence->text());
+
+  // the best line ending at 1 is committed before going on from there
+  config.SetInt("poet/window_size", 1);
+  Poet windowed(nullptr, &config);
+  sentence = windowed.MakeSentence(graph, 3, "");
+  ASSERT_TRUE(bool(sentence));
+  EXPECT_EQ("abc", sentence->text());
+  EXPECT_EQ(3, sentence->components().size());
+  // committed lines are kept on the next keystroke
+  AddEntry(&graph, 3, 4, "d", -1.0);
+  sentence = windowed.MakeSentence(graph, 4, "");
+  ASSERT_TRUE(bool(sentence));
+  EXPECT_EQ("abcd", sentence->text());
+  EXPECT_EQ(4, sentence->components().size());
+}
+
+// random graphs of up to 4-character words, with a few homophones each.
+// integral weights make ties; fractional ones hardly do.
+static WordGraph MakeSyntheticGraph(std::mt19937& rng, int length,
+                                    bool integral_weights = true) {
+  WordGraph graph;
+  std::uniform_int_distribution<int> num_homophones(1, 6);
+  std::uniform_int_distribution<int> weight(-8, -2);
+  std::uniform_real_distribution<double> fraction(0.0, 1.0);
+  for (int start = 0; start < length; ++start) {
+    for (int len = 1; len <= 4 && start + len <= length; ++len) {
+      if (len > 1 && rng() % 3 == 0)
+        continue;
+      auto& entries = graph[start][start + len];
+      for (int i = num_homophones(rng); i > 0; --i) {
+        auto e = New<DictEntry>();
+        e->text = std::to_string(start) + "-" + std::to_string(len) +
+            "-" + std::to_string(i);
+        e->weight = weight(rng);
+        if (!integral_weights)
+          e->weight -= fraction(rng);
+        entries.push_back(e);
+      }
+    }
+  }
+  return graph;
+}
+
+// a sentence by its text, exact weight and word lengths.
+static string DescribeSentence(const string& text,
+                               double weight,
+                               const vector<size_t>& word_lengths) {
+  std::ostringstream result;
+  result.precision(17);
+  result << text << " " << weight;
+  for (size_t word_length : word_lengths) {
+    result << " " << word_length;
+  }
+  return result.str();
+}
+
+// the sentence made from each graph by a new poet, with its weight and
+// word lengths; not to resume from the last graph.
+static vector<string> MakeSentencesFromScratch(const vector<WordGraph>& graphs,
+                                               size_t length,
+                                               Poet::Compare compare) {
+  vector<string> results;
+  for (const auto& graph : graphs) {
+    Poet poet(nullptr, nullptr, compare);
+    auto sentence = poet.MakeSentence(graph, length, "");
+    results.push_back(sentence ? DescribeSentence(sentence->text(),
+                                                  sentence->weight(),
+                                                  sentence->word_lengths())
+                               : string());
+  }
+  return results;
+}
+
+static vector<WordGraph> MakeSyntheticGraphs(unsigned seed,
+                                             int num_graphs,
+                                             int length,
+                                             bool integral_weights = true) {
+  vector<WordGraph> graphs;
+  std::mt19937 rng(seed);
+  for (int i = 0; i < num_graphs; ++i) {
+    graphs.push_back(MakeSyntheticGraph(rng, length, integral_weights));
+  }
+  return graphs;
+}
+
+// a copy of the search as it was before it was specialized for the known
+// comparisons, resumed across keystrokes or made to offer several
+// sentences: lines are compared through a function object, and kept by
+// the text of their last words.
+namespace baseline {
+
+struct Line {
+  const Line* predecessor;
+  const DictEntry* entry;
+  size_t end_pos;
+  double weight;
+
+  static const Line kEmpty;
+
+  bool empty() const {
+    return !predecessor && !entry;
+  }
+
+  string last_word() const {
+    return entry ? entry->text : string();
+  }
+
+  vector<const Line*> components() const {
+    vector<const Line*> lines;
+    for (const Line* cursor = this;
+         !cursor->empty();
+         cursor = cursor->predecessor) {
+      lines.push_back(cursor);
+    }
+    std::reverse(lines.begin(), lines.end());
+    return lines;
+  }
+
+  string context() const {
+    // look back 2 words
+    return empty() ? string() :
+        !predecessor || predecessor->empty() ? last_word() :
+        predecessor->last_word() + last_word();
+  }
+
+  vector<size_t> word_lengths() const {
+    vector<size_t> lengths;
+    size_t last_end_pos = 0;
+    for (const auto* c : components()) {
+      lengths.push_back(c->end_pos - last_end_pos);
+      last_end_pos = c->end_pos;
+    }
+    return lengths;
+  }
+};
+
+const Line Line::kEmpty{nullptr, nullptr, 0, 0.0};
+
+using Compare = function<bool (const Line&, const Line&)>;
+
+static bool CompareWeight(const Line& one, const Line& other) {
+  return one.weight < other.weight;
+}
+
+static bool LeftAssociateCompare(const Line& one, const Line& other) {
+  if (one.weight < other.weight) return true;
+  if (one.weight == other.weight) {
+    auto one_word_lens = one.word_lengths();
+    auto other_word_lens = other.word_lengths();
+    // less words is more favorable
+    if (one_word_lens.size() > other_word_lens.size()) return true;
+    if (one_word_lens.size() == other_word_lens.size()) {
+      return std::lexicographical_compare(
+          one_word_lens.begin(), one_word_lens.end(),
+          other_word_lens.begin(), other_word_lens.end());
+    }
+  }
+  return false;
+}
+
+using LineCandidates = hash_map<string, Line>;
+
+template <int N>
+static vector<const Line*> find_top_candidates(
+    const LineCandidates& candidates, Compare compare) {
+  vector<const Line*> top;
+  top.reserve(N + 1);
+  for (const auto& candidate : candidates) {
+    auto pos = std::upper_bound(
+        top.begin(), top.end(), &candidate.second,
+        [&](const Line* a, const Line* b) { return compare(*b, *a); }); // desc
+    if (pos - top.begin() >= N) continue;
+    top.insert(pos, &candidate.second);
+    if (top.size() > N) top.pop_back();
+  }
+  return top;
+}
+
+using UpdateLineCandidate = function<void (const Line& candidate)>;
+
+struct BeamSearch {
+  using State = LineCandidates;
+
+  static constexpr int kMaxLineCandidates = 7;
+
+  static void Initiate(State& initial_state) {
+    initial_state.emplace("", Line::kEmpty);
+  }
+
+  static void ForEachCandidate(const State& state,
+                               Compare compare,
+                               UpdateLineCandidate update) {
+    auto top_candidates =
+        find_top_candidates<kMaxLineCandidates>(state, compare);
+    for (const auto* candidate : top_candidates) {
+      update(*candidate);
+    }
+  }
+
+  static Line& BestLineToUpdate(State& state, const Line& new_line) {
+    const auto& key = new_line.last_word();
+    return state[key];
+  }
+
+  static const Line& BestLineInState(const State& final_state,
+                                     Compare compare) {
+    const Line* best = nullptr;
+    for (const auto& candidate : final_state) {
+      if (!best || compare(*best, candidate.second)) {
+        best = &candidate.second;
+      }
+    }
+    return best ? *best : Line::kEmpty;
+  }
+};
+
+struct DynamicProgramming {
+  using State = Line;
+
+  static void Initiate(State& initial_state) {
+    initial_state = Line::kEmpty;
+  }
+
+  static void ForEachCandidate(const State& state,
+                               Compare compare,
+                               UpdateLineCandidate update) {
+    update(state);
+  }
+
+  static Line& BestLineToUpdate(State& state, const Line& new_line) {
+    return state;
+  }
+
+  static const Line& BestLineInState(const State& final_state,
+                                     Compare compare) {
+    return final_state;
+  }
+};
+
+template <class Strategy>
+static string MakeSentenceWithStrategy(const WordGraph& graph,
+                                       size_t total_length,
+                                       const string& preceding_text,
+                                       Grammar* grammar,
+                                       Compare compare) {
+  map<int, typename Strategy::State> states;
+  Strategy::Initiate(states[0]);
+  for (const auto& sv : graph) {
+    size_t start_pos = sv.first;
+    if (states.find(start_pos) == states.end())
+      continue;
+    const auto& source_state = states[start_pos];
+    const auto update =
+        [&states, &sv, start_pos, total_length, &preceding_text, grammar,
+         &compare](const Line& candidate) {
+          for (const auto& ev : sv.second) {
+            size_t end_pos = ev.first;
+            if (start_pos == 0 && end_pos == total_length)
+              continue;  // exclude single word from the result
+            bool is_rear = end_pos == total_length;
+            auto& target_state = states[end_pos];
+            // extend candidates with dict entries on a valid edge.
+            const DictEntryList& entries = ev.second;
+            for (const auto& entry : entries) {
+              const string& context =
+                  candidate.empty() ? preceding_text : candidate.context();
+              double weight = candidate.weight +
+                              Grammar::Evaluate(context,
+                                                entry->text,
+                                                entry->weight,
+                                                is_rear,
+                                                grammar);
+              Line new_line{&candidate, entry.get(), end_pos, weight};
+              Line& best = Strategy::BestLineToUpdate(target_state, new_line);
+              if (best.empty() || compare(best, new_line)) {
+                best = new_line;
+              }
+            }
+          }
+        };
+    Strategy::ForEachCandidate(source_state, compare, update);
+  }
+  auto found = states.find(total_length);
+  if (found == states.end() || found->second.empty())
+    return string();
+  const Line& best = Strategy::BestLineInState(found->second, compare);
+  string text;
+  for (const auto* c : best.components()) {
+    text += c->last_word();
+  }
+  return DescribeSentence(text, best.weight, best.word_lengths());
+}
+
+// the sentence made from each graph, with a grammar if given.
+static vector<string> MakeSentences(const vector<WordGraph>& graphs,
+                                    size_t length,
+                                    Grammar* grammar,
+                                    Compare compare) {
+  vector<string> results;
+  for (const auto& graph : graphs) {
+    results.push_back(grammar ?
+                      MakeSentenceWithStrategy<BeamSearch>(
+                          graph, length, "", grammar, compare) :
+                      MakeSentenceWithStrategy<DynamicProgramming>(
+                          graph, length, "", grammar, compare));
+  }
+  return results;
+}
+
+}  // namespace baseline
+
+// an opaque comparison, for which the search is not specialized.
+static Poet::Compare Opaque(Poet::Compare compare) {
+  return [compare](const Line& one, const Line& other) {
+    return compare(one, other);
+  };
+}
+
+// the search makes the same sentences as the baseline, through the known
+// comparisons and opaque ones alike. without a grammar, lines of equal
+// weights are visited in graph order by both, so that they make the same
+// sentences from graphs with ties; with a grammar, the baseline visited
+// lines in the hash order of their texts, so that only the best lines
+// without ties are bound to agree.
+TEST_F(RimePoetTest, SpecializedComparison) {
+  const int kLength = 24;
+  const struct {
+    Poet::Compare current;
+    baseline::Compare baseline;
+  } compares[] = {
+    {Poet::CompareWeight, baseline::CompareWeight},
+    {Poet::LeftAssociateCompare, baseline::LeftAssociateCompare},
+  };
+  for (bool with_grammar : {false, true}) {
+    the<Grammar> grammar;
+    if (with_grammar) {
+      Registry::instance().Register("grammar", new HashGrammarComponent);
+      grammar.reset(new HashGrammar);
+    }
+    else {
+      Registry::instance().Unregister("grammar");
+    }
+    auto graphs = MakeSyntheticGraphs(48, 100, kLength, !with_grammar);
+    for (const auto& compare : compares) {
+      auto expected = baseline::MakeSentences(graphs, kLength, grammar.get(),
+                                              compare.baseline);
+      for (const auto& result : expected) {
+        EXPECT_FALSE(result.empty());
+      }
+      EXPECT_EQ(expected,
+                MakeSentencesFromScratch(graphs, kLength, compare.current));
+      EXPECT_EQ(expected,
+                MakeSentencesFromScratch(graphs, kLength,
+                                         Opaque(compare.current)));
+    }
+  }
+}
+
+// timing only; run with --gtest_also_run_disabled_tests.
+TEST_F(RimePoetTest, DISABLED_SpecializedComparisonBenchmark) {
+  const int kNumGraphs = 100;
+  const int kLength = 24;
+  auto graphs = MakeSyntheticGraphs(48, kNumGraphs, kLength);
+  FlatGrammar grammar;
+  const struct {
+    const char* name;
+    Poet::Compare current;
+    baseline::Compare baseline;
+  } compares[] = {
+    {"CompareWeight", Poet::CompareWeight, baseline::CompareWeight},
+    {"LeftAssociateCompare",
+     Poet::LeftAssociateCompare, baseline::LeftAssociateCompare},
+  };
+  for (const auto& compare : compares) {
+    double elapsed[3] = {};
+    for (int k = 0; k < 3; ++k) {
+      auto start = std::chrono::steady_clock::now();
+      if (k < 2) {
+        MakeSentencesFromScratch(graphs, kLength,
+                                 k == 0 ? compare.current :
+                                 Opaque(compare.current));
+      }
+      else {
+        baseline::MakeSentences(graphs, kLength, &grammar, compare.baseline);
+      }
+      std::chrono::duration<double, std::micro> duration =
+          std::chrono::steady_clock::now() - start;
+      elapsed[k] = duration.count();
+    }
+    std::cout << compare.name << ": "
+              << elapsed[0] / kNumGraphs << " us per graph, "
+              << elapsed[1] / kNumGraphs << " us through an opaque comparison, "
+              << elapsed[2] / kNumGraphs << " us by the baseline."
+              << std::endl;
+  }
+}
+
+// with a grammar, the sentences come best first from the beam, the first
+// being the best sentence.
+TEST_F(RimePoetTest, TopSentencesFromTheBeam) {
+  Registry::instance().Register("grammar", new HashGrammarComponent);
+  const int kLength = 16;
+  auto graphs = MakeSyntheticGraphs(46, 20, kLength);
+  for (const auto& graph : graphs) {
+    Poet poet(nullptr, nullptr);
+    auto best = Poet(nullptr, nullptr).MakeSentence(graph, kLength, "");
+    ASSERT_TRUE(bool(best));
+    auto translation = poet.MakeSentences(graph, kLength, "", 10);
+    ASSERT_TRUE(bool(translation));
+    set<string> texts;
+    double last_weight = best->weight();
+    for (; !translation->exhausted(); translation->Next()) {
+      auto sentence = As<Sentence>(translation->Peek());
+      if (texts.empty()) {
+        EXPECT_EQ(best->text(), sentence->text());
+      }
+      EXPECT_TRUE(texts.insert(sentence->text()).second);
+      EXPECT_LE(sentence->weight(), last_weight);
+      last_weight = sentence->weight();
+    }
+    EXPECT_EQ(10, texts.size());
+  }
+}
+
+static string DescribeSentences(an<Translation> translation) {
+  string result;
+  for (; translation && !translation->exhausted(); translation->Next()) {
+    auto sentence = As<Sentence>(translation->Peek());
+    result += sentence->text() + " " + std::to_string(sentence->weight());
+    for (size_t length : sentence->word_lengths()) {
+      result += " " + std::to_string(length);
+    }
+    result += "; ";
+  }
+  return result;
+}
+
+// scores like HashGrammar, but is not thread-safe; records the threads it
+// is queried from.
+class ThreadRecordingGrammar : public HashGrammar {
+ public:
+  double Query(const string& context,
+               const string& word,
+               bool is_rear) override {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      threads.insert(std::this_thread::get_id());
+    }
+    return HashGrammar::Query(context, word, is_rear);
+  }
+  bool thread_safe() const override { return false; }
+
+  static std::mutex mutex;
+  static set<std::thread::id> threads;
+};
+
+std::mutex ThreadRecordingGrammar::mutex;
+set<std::thread::id> ThreadRecordingGrammar::threads;
+
+class ThreadRecordingGrammarComponent : public Grammar::Component {
+ public:
+  Grammar* Create(Config* config) override {
+    return new ThreadRecordingGrammar;
+  }
+};
+
+// the top sentences made from each graph in turn by the poet.
+static vector<string> MakeSentencesInTurn(Poet* poet,
+                                          const vector<WordGraph>& graphs,
+                                          size_t length) {
+  vector<string> results;
+  for (const auto& graph : graphs) {
+    results.push_back(
+        DescribeSentences(poet->MakeSentences(graph, length, "", 3)));
+  }
+  return results;
+}
+
+class RimePoetParallelTest : public RimePoetTest {
+ protected:
+  static const int kLength = 32;
+
+  void SetUp() override {
+    RimePoetTest::SetUp();
+    Registry::instance().Register("grammar", new HashGrammarComponent);
+    graphs_ = MakeSyntheticGraphs(50, 50, kLength);
+    config_.SetInt("poet/parallel_min_length", kLength);
+    config_.SetInt("poet/parallel_threads", 4);
+    single_threaded_.reset(new Poet(nullptr, &config_));
+    config_.SetBool("poet/parallel", true);
+  }
+
+  vector<WordGraph> graphs_;
+  Config config_;
+  the<Poet> single_threaded_;
+};
+
+// the edges scored on a pool of threads make the same sentences.
+TEST_F(RimePoetParallelTest, ParallelScoring) {
+  Poet parallel(nullptr, &config_);
+  auto expected = MakeSentencesInTurn(single_threaded_.get(), graphs_, kLength);
+  auto actual = MakeSentencesInTurn(&parallel, graphs_, kLength);
+  EXPECT_EQ(expected, actual);
+  for (const auto& result : actual) {
+    EXPECT_FALSE(result.empty());
+  }
+}
+
+// a grammar that is not thread-safe is queried from a single thread.
+TEST_F(RimePoetParallelTest, UnsafeGrammarQueriedInOneThread) {
+  Registry::instance().Register("grammar",
+                                new ThreadRecordingGrammarComponent);
+  ThreadRecordingGrammar::threads.clear();
+  Poet parallel(nullptr, &config_);
+  auto results = MakeSentencesInTurn(&parallel, graphs_, kLength);
+  EXPECT_EQ(
+      MakeSentencesInTurn(single_threaded_.get(), graphs_, kLength),
+      results);
+  ASSERT_EQ(1, ThreadRecordingGrammar::threads.size());
+  EXPECT_EQ(std::this_thread::get_id(),
+            *ThreadRecordingGrammar::threads.begin());
+}
+
+// timing only; run with --gtest_also_run_disabled_tests.
+TEST_F(RimePoetParallelTest, DISABLED_ParallelScoringBenchmark) {
+  Poet parallel(nullptr, &config_);
+  Poet* poets[2] = {single_threaded_.get(), &parallel};
+  double elapsed[2] = {};
+  for (int k = 0; k < 2; ++k) {
+    auto start = std::chrono::steady_clock::now();
+    MakeSentencesInTurn(poets[k], graphs_, kLength);
+    std::chrono::duration<double, std::micro> duration =
+        std::chrono::steady_clock::now() - start;
+    elapsed[k] = duration.count();
+  }
+  std::cout << "single thread: " << elapsed[0] / graphs_.size()
+            << " us per graph; 4 threads: " << elapsed[1] / graphs_.size()
+            << " us per graph." << std::endl;
+}
+
+// types the graph one keystroke at a time, and compares the sentences made
+// by resuming from the last keystroke with those made from scratch. returns
+// the queries counted through CountingGrammar, from scratch and resumed.
+static pair<size_t, size_t> TypeEachKeystroke(const WordGraph& full_graph,
+                                              int total_length) {
+  Poet resumed(nullptr, nullptr);
+  size_t fresh_queries = 0;
+  size_t resumed_queries = 0;
+  for (int length = 1; length <= total_length; ++length) {
+    // the edges typed so far
+    WordGraph graph;
+    for (const auto& sv : full_graph) {
+      for (const auto& ev : sv.second) {
+        if (ev.first <= length)
+          graph[sv.first][ev.first] = ev.second;
+      }
+    }
+    CountingGrammar::num_queries = 0;
+    string expected =
+        DescribeSentences(Poet(nullptr, nullptr).MakeSentences(
+            graph, length, "", 3));
+    fresh_queries += CountingGrammar::num_queries;
+    CountingGrammar::num_queries = 0;
+    string actual =
+        DescribeSentences(resumed.MakeSentences(graph, length, "", 3));
+    resumed_queries += CountingGrammar::num_queries;
+    // a single word is not made a sentence
+    EXPECT_EQ(length > 1, !expected.empty());
+    EXPECT_EQ(expected, actual) << "after " << length << " keystrokes";
+  }
+  return {fresh_queries, resumed_queries};
+}
+
+// the sentences made by resuming are those made from scratch, with far
+// fewer queries.
+TEST_F(RimePoetTest, ResumeOnEachKeystroke) {
+  Registry::instance().Register("grammar", new CountingGrammarComponent);
+  const int kLength = 40;
+  std::mt19937 rng(42);
+  auto queries = TypeEachKeystroke(MakeSyntheticGraph(rng, kLength), kLength);
+  size_t fresh_queries = queries.first;
+  size_t resumed_queries = queries.second;
+  RecordProperty("fresh_queries", static_cast<int>(fresh_queries));
+  RecordProperty("resumed_queries", static_cast<int>(resumed_queries));
+  EXPECT_LT(resumed_queries * 4, fresh_queries);
+}
+
+// among lines of equal weights, fewer words are preferred, then the texts
+// of the words in order.
+// of lines of equal weights, the one found first is kept and ranked first,
+// as the words on an edge and the edges from a position are visited in
+// order.
+TEST_F(RimePoetTest, TiesGoToTheLineFoundFirst) {
+  WordGraph graph;
+  AddEntry(&graph, 0, 1, "a", -1.0);
+  AddEntry(&graph, 0, 2, "ab", -2.0);
+  AddEntry(&graph, 1, 2, "b", -1.0);
+  AddEntry(&graph, 2, 3, "y", -1.0);
+  AddEntry(&graph, 2, 3, "x", -1.0);
+  for (auto compare : {Poet::CompareWeight, Poet::LeftAssociateCompare}) {
+    Poet poet(nullptr, nullptr, compare);
+    auto translation = poet.MakeSentences(graph, 3, "", 4);
+    ASSERT_TRUE(bool(translation));
+    vector<an<Sentence>> sentences;
+    for (; !translation->exhausted(); translation->Next()) {
+      sentences.push_back(As<Sentence>(translation->Peek()));
+    }
+    ASSERT_EQ(2, sentences.size());
+    EXPECT_EQ("aby", sentences[0]->text());
+    EXPECT_EQ(2, sentences[0]->components().size());
+    EXPECT_EQ("abx", sentences[1]->text());
+    EXPECT_EQ(2, sentences[1]->components().size());
+  }
+}
+
+// with scores coarse enough to tie, resuming still makes the sentences made
+// from scratch, although words are interned in a different order.
+TEST_F(RimePoetTest, ResumeWithTies) {
+  Registry::instance().Register("grammar", new HashGrammarComponent);
+  const int kLength = 40;
+  for (unsigned seed = 0; seed < 10; ++seed) {
+    std::mt19937 rng(seed);
+    TypeEachKeystroke(MakeSyntheticGraph(rng, kLength), kLength);
+  }
+}
@@ -6,6 +6,7 @@
 //
 #include <algorithm>
 #include <gtest/gtest.h>
+#include <rime/algo/algebra.h>
 #include <rime/dict/prism.h>
 
 using namespace rime;
@@ -89,3 +90,72 @@ TEST_F(RimePrismTest, ExpandSearch) {
   EXPECT_EQ(result[2].value, 3);  // goodbye
   EXPECT_EQ(result[2].length, 7);  // goodbye
 }
+
+TEST_F(RimePrismTest, ExpandSearchWithCompletionIndex) {
+  Prism indexed("prism_completion_test.bin");
+  indexed.Remove();
+  set<string> keyset{"google", "good", "goodbye", "microsoft",
+                     "macrosoft", "adobe", "yahoo", "baidu"};
+  ASSERT_TRUE(indexed.Build(keyset, nullptr, 0, 0, 2));
+  ASSERT_TRUE(indexed.Save());
+  Prism loaded(indexed.file_name());
+  ASSERT_TRUE(loaded.Load());
+  // short prefixes are served by the index, longer ones by traversal;
+  // either way the results must be the same as without the index.
+  for (const string& key : {"g", "go", "goo", "m", "ma", "x", "gx", ""}) {
+    for (size_t limit : {0, 1, 2, 10}) {
+      vector<Prism::Match> expected;
+      vector<Prism::Match> actual;
+      prism_->ExpandSearch(key, &expected, limit);
+      loaded.ExpandSearch(key, &actual, limit);
+      ASSERT_EQ(expected.size(), actual.size()) << key << " " << limit;
+      for (size_t i = 0; i < expected.size(); ++i) {
+        EXPECT_EQ(expected[i].value, actual[i].value);
+        EXPECT_EQ(expected[i].length, actual[i].length);
+      }
+    }
+  }
+  loaded.Remove();
+}
+
+TEST(RimePrismBuildTest, SpellingMapWithTips) {
+  Prism prism("prism_spelling_test.bin");
+  prism.Remove();
+  Syllabary syllabary{"a", "ab", "b"};
+  Script script;
+  for (const string& syllable : syllabary) {
+    script.AddSyllable(syllable);
+  }
+  // long tips must not outgrow the space reserved for the spelling map
+  for (auto& spellings : script) {
+    for (auto& spelling : spellings.second) {
+      spelling.properties.tips = string(100, '~') + spelling.str;
+    }
+  }
+  ASSERT_TRUE(prism.Build(syllabary, &script, 0, 0, 1));
+  for (int pass = 0; pass < 2; ++pass) {
+    int value = -1;
+    ASSERT_TRUE(prism.GetValue("ab", &value));
+    SpellingAccessor accessor(prism.QuerySpelling(value));
+    ASSERT_FALSE(accessor.exhausted());
+    EXPECT_EQ(1, accessor.syllable_id());
+    EXPECT_EQ(string(100, '~') + "ab", accessor.properties().tips);
+    vector<Prism::Match> result;
+    prism.ExpandSearch("a", &result, 0);
+    EXPECT_EQ(2, result.size());
+    // saving maps the double array again
+    ASSERT_TRUE(prism.Save());
+  }
+  prism.Remove();
+}
+
+TEST_F(RimePrismTest, Sections) {
+  ASSERT_TRUE(prism_->Save());
+  ASSERT_TRUE(prism_->Verify());
+  auto section = prism_->FindSection(prism::kDoubleArraySection);
+  ASSERT_TRUE(section != nullptr);
+  EXPECT_EQ(prism_->array_size() * 4, section->size);
+  // no spellings or completions without a script or completion depth
+  EXPECT_EQ(nullptr, prism_->FindSection(prism::kSpellingMapSection));
+  EXPECT_EQ(nullptr, prism_->FindSection(prism::kCompletionIndexSection));
+}
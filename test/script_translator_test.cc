@@ -0,0 +1,112 @@
+//
+// Copyright RIME Developers
+// Distributed under the BSD License
+//
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <gtest/gtest.h>
+#include <rime/candidate.h>
+#include <rime/common.h>
+#include <rime/config.h>
+#include <rime/engine.h>
+#include <rime/schema.h>
+#include <rime/segmentation.h>
+#include <rime/ticket.h>
+#include <rime/translation.h>
+#include <rime/dict/dict_compiler.h>
+#include <rime/dict/dictionary.h>
+#include <rime/gear/script_translator.h>
+
+using namespace rime;
+
+class RimeScriptTranslatorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // the files are looked up by the dictionary component
+    Dictionary dict("dictionary_test",
+                    {},
+                    {New<Table>("dictionary_test.table.bin")},
+                    New<Prism>("dictionary_test.prism.bin"));
+    DictCompiler dict_compiler(&dict);
+    ASSERT_TRUE(dict_compiler.Compile(""));  // no schema file
+
+    engine_.reset(Engine::Create());
+    Config* config = new Config;
+    config->SetString("translator/dictionary", "dictionary_test");
+    config->SetBool("translator/enable_user_dict", false);
+    config->SetBool("translator/async_compose", true);
+    config->SetInt("translator/async_compose_min_length", 1);
+    engine_->ApplySchema(new Schema("script_translator_test", config));
+    engine_->async_message_sink().connect(
+        [this](const string& type, const string& value) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          messages_.push_back(type + "/" + value);
+          message_threads_.push_back(std::this_thread::get_id());
+          message_arrived_.notify_all();
+        });
+    translator_.reset(new ScriptTranslator(Ticket(engine_.get(),
+                                                  "translator")));
+  }
+
+  void TearDown() override {
+    translator_.reset();
+    engine_.reset();
+  }
+
+  static Segment MakeSegment(size_t start, size_t end) {
+    Segment segment(start, end);
+    segment.tags.insert("abc");
+    return segment;
+  }
+
+  // waits for the number of messages, without calling into the engine.
+  bool WaitForMessages(size_t count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return message_arrived_.wait_for(
+        lock, std::chrono::seconds(10),
+        [this, count] { return messages_.size() >= count; });
+  }
+
+  the<Engine> engine_;
+  the<ScriptTranslator> translator_;
+  std::mutex mutex_;
+  std::condition_variable message_arrived_;
+  vector<string> messages_;
+  vector<std::thread::id> message_threads_;
+};
+
+TEST_F(RimeScriptTranslatorTest, AsyncCompose) {
+  ASSERT_TRUE(translator_->async_compose());
+  // segments of "ba'bai", queried in turn in the same composition
+  auto first = translator_->Query("ba", MakeSegment(0, 2));
+  auto second = translator_->Query("bai", MakeSegment(3, 6));
+  ASSERT_TRUE(bool(first));
+  ASSERT_TRUE(bool(second));
+  // the front end is told as soon as each menu is ready, from the worker
+  ASSERT_TRUE(WaitForMessages(2));
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    EXPECT_EQ("menu/ready", messages_[0]);
+    EXPECT_EQ("menu/ready", messages_[1]);
+    EXPECT_NE(std::this_thread::get_id(), message_threads_[0]);
+  }
+  // the query for the second segment did not cancel the first one
+  auto candidate = first->Peek();
+  ASSERT_TRUE(bool(candidate));
+  EXPECT_EQ("\xe5\x90\xa7", candidate->text());  // 吧
+  candidate = second->Peek();
+  ASSERT_TRUE(bool(candidate));
+  EXPECT_EQ("\xe7\x99\xbd", candidate->text());  // 白
+  EXPECT_EQ(3, candidate->start());
+
+  // querying the same segment again replaces the earlier translation
+  auto replaced = translator_->Query("bai", MakeSegment(0, 3));
+  EXPECT_TRUE(bool(replaced));
+  auto replacing = translator_->Query("ba", MakeSegment(0, 2));
+  ASSERT_TRUE(bool(replacing));
+  candidate = replacing->Peek();
+  ASSERT_TRUE(bool(candidate));
+  EXPECT_EQ("\xe5\x90\xa7", candidate->text());
+}
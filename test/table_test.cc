@@ -4,7 +4,22 @@
 //
 // 2011-07-03 GONG Chen <chen.sst@gmail.com>
 //
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
 #include <gtest/gtest.h>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif  // __linux__
 #include <rime/algo/syllabifier.h>
 #include <rime/dict/table.h>
 
@@ -145,18 +160,101 @@ TEST_F(RimeTableTest, SimpleQuery) {
   v = table_->QueryPhrases(code);
   EXPECT_FALSE(v.exhausted());
   EXPECT_EQ(2, v.remaining());
-  ASSERT_TRUE(v.entry() != NULL);
-  EXPECT_STREQ("yi-er-san-si", Text(v).c_str());
-  ASSERT_TRUE(v.extra_code() != NULL);
-  ASSERT_EQ(1, v.extra_code()->size);
-  EXPECT_EQ(4, *v.extra_code()->at);
-  EXPECT_TRUE(v.Next());
+  // tail entries are sorted by extra code
   ASSERT_TRUE(v.entry() != NULL);
   EXPECT_STREQ("yi-er-san-er-yi", Text(v).c_str());
   ASSERT_TRUE(v.extra_code() != NULL);
   ASSERT_EQ(2, v.extra_code()->size);
   EXPECT_EQ(2, v.extra_code()->at[0]);
   EXPECT_EQ(1, v.extra_code()->at[1]);
+  EXPECT_TRUE(v.Next());
+  ASSERT_TRUE(v.entry() != NULL);
+  EXPECT_STREQ("yi-er-san-si", Text(v).c_str());
+  ASSERT_TRUE(v.extra_code() != NULL);
+  ASSERT_EQ(1, v.extra_code()->size);
+  EXPECT_EQ(4, *v.extra_code()->at);
+}
+
+TEST_F(RimeTableTest, StringCache) {
+  // the cache is set up as the table is loaded; there are fewer strings
+  // than slots, so that no two strings share a slot.
+  table_->set_string_cache_size(64);
+  ASSERT_TRUE(table_->Load());
+  EXPECT_EQ(0, table_->num_string_cache_hits());
+  for (int round = 0; round < 2; ++round) {
+    rime::TableAccessor v = table_->QueryWords(2);
+    ASSERT_EQ(3, v.remaining());
+    EXPECT_STREQ("er", Text(v).c_str());
+    v.Next();
+    EXPECT_STREQ("liang", Text(v).c_str());
+    v.Next();
+    EXPECT_STREQ("lia", Text(v).c_str());
+    // syllables share the string table
+    EXPECT_STREQ("3", table_->GetSyllableById(3).c_str());
+  }
+  // the strings decoded in the first round are cached for the second
+  EXPECT_EQ(4, table_->num_string_cache_hits());
+}
+
+TEST_F(RimeTableTest, StringCacheSizeAppliesOnNextLoad) {
+  rime::Table table(file_name);
+  ASSERT_TRUE(table.Load());
+  table.set_string_cache_size(64);
+  for (int round = 0; round < 2; ++round) {
+    EXPECT_STREQ("3", table.GetSyllableById(3).c_str());
+  }
+  EXPECT_EQ(0, table.num_string_cache_hits());
+  table.Close();
+  ASSERT_TRUE(table.Load());
+  for (int round = 0; round < 2; ++round) {
+    EXPECT_STREQ("3", table.GetSyllableById(3).c_str());
+  }
+  EXPECT_EQ(1, table.num_string_cache_hits());
+}
+
+TEST(RimeStringTableTest, CacheSharedByThreads) {
+  const int kNumKeys = 100;
+  const int kNumThreads = 4;
+  const int kRounds = 50;
+  rime::StringTableBuilder builder;
+  for (int i = 0; i < kNumKeys; ++i) {
+    builder.Add("key" + std::to_string(i));
+  }
+  builder.Build();
+  std::vector<char> image(builder.BinarySize());
+  builder.Dump(image.data(), image.size());
+  // fewer slots than keys, so that threads replace each other's strings
+  rime::StringTable table(image.data(), image.size(), 16);
+  std::vector<rime::StringId> ids;
+  for (int i = 0; i < kNumKeys; ++i) {
+    ids.push_back(table.Lookup("key" + std::to_string(i)));
+  }
+  std::atomic<int> mismatches{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([&] {
+      for (int round = 0; round < kRounds; ++round) {
+        for (int i = 0; i < kNumKeys; ++i) {
+          if (table.GetString(ids[i]) != "key" + std::to_string(i))
+            ++mismatches;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(0, mismatches);
+  EXPECT_EQ(kNumThreads * kRounds * kNumKeys, table.num_lookups());
+  EXPECT_LT(table.num_cache_hits(), table.num_lookups());
+  // with a slot for every key, the second round is served from the cache
+  rime::StringTable roomy(image.data(), image.size(), kNumKeys);
+  for (int round = 0; round < 2; ++round) {
+    for (int i = 0; i < kNumKeys; ++i) {
+      roomy.GetString(ids[i]);
+    }
+  }
+  EXPECT_EQ(kNumKeys, roomy.num_cache_hits());
 }
 
 TEST_F(RimeTableTest, QueryWithSyllableGraph) {
@@ -175,6 +273,7 @@ TEST_F(RimeTableTest, QueryWithSyllableGraph) {
   g.edges[2][4][2].end_pos = 4;
   g.edges[4][7][3].type = rime::kNormalSpelling;
   g.edges[4][7][3].end_pos = 7;
+  g.edges[4][7][3].is_correction = true;
   g.edges[7][9][4].type = rime::kNormalSpelling;
   g.edges[7][9][4].end_pos = 9;
   g.indices[0][1].push_back(&g.edges[0][2][1]);
@@ -185,26 +284,396 @@ TEST_F(RimeTableTest, QueryWithSyllableGraph) {
   rime::TableQueryResult result;
   ASSERT_TRUE(table_->Query(g, 0, &result));
   EXPECT_EQ(2, result.size());
-  ASSERT_TRUE(result.find(2) != result.end());
-  ASSERT_EQ(1, result[2].size());
-  EXPECT_STREQ("yi", Text(result[2].front()).c_str());
-  ASSERT_TRUE(result.find(7) != result.end());
-  ASSERT_EQ(2, result[7].size());
-  EXPECT_STREQ("yi-er-san", Text(result[7].front()).c_str());
-  EXPECT_STREQ("yi-er-san-si", Text(result[7].back()).c_str());
-  ASSERT_EQ(1, result[7].back().extra_code()->size);
-  EXPECT_EQ(4, result[7].back().extra_code()->at[0]);
-  ASSERT_TRUE(result.find(6) == result.end());
-  ASSERT_TRUE(result.find(7) != result.end());
+  ASSERT_TRUE(result.has(2));
+  ASSERT_EQ(1, result.at(2).size());
+  EXPECT_STREQ("yi", Text(result.at(2).front()).c_str());
+  ASSERT_TRUE(result.has(7));
+  ASSERT_EQ(2, result.at(7).size());
+  EXPECT_STREQ("yi-er-san", Text(result.at(7).front()).c_str());
+  // the syllables taken in the graph
+  const rime::SyllableStep* path = result.at(7).front().path();
+  EXPECT_EQ(2, path[0].end_pos);
+  EXPECT_EQ(4, path[1].end_pos);
+  EXPECT_EQ(7, path[2].end_pos);
+  EXPECT_FALSE(path[1].is_correction);
+  EXPECT_TRUE(path[2].is_correction);
+  // tail entries are sorted by extra code
+  EXPECT_STREQ("yi-er-san-er-yi", Text(result.at(7).back()).c_str());
+  ASSERT_EQ(2, result.at(7).back().extra_code()->size);
+  EXPECT_EQ(2, result.at(7).back().extra_code()->at[0]);
+  EXPECT_EQ(1, result.at(7).back().extra_code()->at[1]);
+  EXPECT_TRUE(result.at(7).back().Next());
+  EXPECT_STREQ("yi-er-san-si", Text(result.at(7).back()).c_str());
+  ASSERT_EQ(1, result.at(7).back().extra_code()->size);
+  EXPECT_EQ(4, result.at(7).back().extra_code()->at[0]);
+  ASSERT_FALSE(result.has(6));
+  ASSERT_TRUE(result.has(7));
 
   ASSERT_TRUE(table_->Query(g, 2, &result));
   EXPECT_EQ(1, result.size());
-  ASSERT_TRUE(result.find(4) != result.end());
-  ASSERT_EQ(1, result[4].size());
-  EXPECT_STREQ("er", Text(result[4].front()).c_str());
-  EXPECT_TRUE(result[4].front().Next());
-  EXPECT_STREQ("liang", Text(result[4].front()).c_str());
-  EXPECT_TRUE(result[4].front().Next());
-  EXPECT_STREQ("lia", Text(result[4].front()).c_str());
-  EXPECT_FALSE(result[4].front().Next());
+  ASSERT_TRUE(result.has(4));
+  ASSERT_EQ(1, result.at(4).size());
+  EXPECT_STREQ("er", Text(result.at(4).front()).c_str());
+  EXPECT_TRUE(result.at(4).front().Next());
+  EXPECT_STREQ("liang", Text(result.at(4).front()).c_str());
+  EXPECT_TRUE(result.at(4).front().Next());
+  EXPECT_STREQ("lia", Text(result.at(4).front()).c_str());
+  EXPECT_FALSE(result.at(4).front().Next());
+}
+
+// the former implementation of Table::Query on top of the public API,
+// breadth-first with per-state copies of the code and credibility.
+struct ReferenceHit {
+  size_t end_pos;
+  rime::TableAccessor accessor;
+  double credibility;
+};
+
+static std::vector<ReferenceHit> ReferenceQuery(rime::Table* table,
+                                                const rime::SyllableGraph& g,
+                                                size_t start_pos) {
+  struct State {
+    size_t pos;
+    rime::Code code;
+    double credibility;
+  };
+  std::vector<ReferenceHit> hits;
+  std::queue<State> q;
+  q.push({start_pos, rime::Code(), 0.0});
+  while (!q.empty()) {
+    State state = q.front();
+    q.pop();
+    auto index = g.indices.find(state.pos);
+    if (index == g.indices.end())
+      continue;
+    if (state.code.size() == rime::kIndexCodeMaxLength) {
+      rime::Code code(state.code);
+      code.push_back(-1);
+      auto a = table->QueryPhrases(code);
+      if (!a.exhausted())
+        hits.push_back({state.pos, a, state.credibility});
+      continue;
+    }
+    for (const auto& spellings : index->second) {
+      for (auto props : spellings.second) {
+        rime::Code code(state.code);
+        code.push_back(spellings.first);
+        double credibility = state.credibility + props->credibility;
+        auto a = table->QueryPhrases(code);
+        if (!a.exhausted())
+          hits.push_back({props->end_pos, a, credibility});
+        if (props->end_pos < g.interpreted_length)
+          q.push({props->end_pos, code, credibility});
+      }
+    }
+  }
+  return hits;
+}
+
+TEST_F(RimeTableTest, RandomizedQueryMatchesReference) {
+  std::mt19937 rng(20230512);
+  for (int round = 0; round < 200; ++round) {
+    rime::SyllableGraph g;
+    const size_t length = 2 + rng() % 8;
+    g.input_length = g.interpreted_length = length;
+    for (size_t start = 0; start < length; ++start) {
+      g.vertices[start] = rime::kNormalSpelling;
+      for (int i = rng() % 4; i > 0; --i) {
+        size_t end = start + 1 + rng() % 3;
+        if (end > length)
+          continue;
+        rime::SyllableId syllable_id = rng() % 6;
+        auto& props = g.edges[start][end][syllable_id];
+        props.type = rime::kNormalSpelling;
+        props.end_pos = end;
+        props.credibility = -0.1 * (rng() % 10);
+      }
+    }
+    for (auto& start : g.edges) {
+      for (auto& end : start.second) {
+        for (auto& spelling : end.second) {
+          g.indices[start.first][spelling.first].push_back(&spelling.second);
+        }
+      }
+    }
+    for (size_t start_pos = 0; start_pos < length; ++start_pos) {
+      auto expected = ReferenceQuery(table_.get(), g, start_pos);
+      rime::TableQueryResult result;
+      EXPECT_EQ(!expected.empty(), table_->Query(g, start_pos, &result));
+      size_t num_hits = 0;
+      for (size_t end_pos = 0; end_pos < result.end_pos_limit(); ++end_pos) {
+        num_hits += result.at(end_pos).size();
+      }
+      ASSERT_EQ(expected.size(), num_hits);
+      std::map<size_t, size_t> cursors;
+      for (const auto& hit : expected) {
+        ASSERT_TRUE(result.has(hit.end_pos));
+        const auto& actual = result.at(hit.end_pos)[cursors[hit.end_pos]++];
+        EXPECT_EQ(hit.accessor.entry(), actual.entry());
+        EXPECT_EQ(hit.accessor.remaining(), actual.remaining());
+        EXPECT_TRUE(hit.accessor.code() == actual.code());
+        EXPECT_DOUBLE_EQ(hit.credibility, actual.credibility());
+      }
+    }
+  }
+}
+
+static rime::Code MakeCode(std::initializer_list<rime::SyllableId> ids) {
+  rime::Code code;
+  code.assign(ids);
+  return code;
+}
+
+// wide enough trunk indices to be given rank directories.
+TEST(RimeTableRankIndexTest, QueryPhrases) {
+  const int kNumSyllables = 64;
+  rime::Syllabary syll;
+  for (int i = 0; i < kNumSyllables; ++i) {
+    syll.insert(std::to_string(1000 + i));
+  }
+  rime::Vocabulary voc;
+  size_t num_entries = 0;
+  auto lv2 = rime::New<rime::Vocabulary>();
+  voc[1].next_level = lv2;
+  for (int i = 0; i < kNumSyllables; i += 2) {
+    auto d = rime::New<rime::DictEntry>();
+    d->code = MakeCode({1, i});
+    d->text = "1-" + std::to_string(i);
+    (*lv2)[i].entries.push_back(d);
+    ++num_entries;
+    auto lv3 = rime::New<rime::Vocabulary>();
+    (*lv2)[i].next_level = lv3;
+    for (int j = 1; j < kNumSyllables; j += 3) {
+      d = rime::New<rime::DictEntry>();
+      d->code = MakeCode({1, i, j});
+      d->text = "1-" + std::to_string(i) + "-" + std::to_string(j);
+      (*lv3)[j].entries.push_back(d);
+      ++num_entries;
+    }
+  }
+  rime::Table table("table_rank_test.bin");
+  table.Remove();
+  ASSERT_TRUE(table.Build(syll, voc, num_entries));
+  ASSERT_TRUE(table.Save());
+  table.Close();
+  ASSERT_TRUE(table.Load());
+  for (int i = 0; i < kNumSyllables; ++i) {
+    rime::Code code(MakeCode({1, i}));
+    auto a = table.QueryPhrases(code);
+    if (i % 2 == 0) {
+      ASSERT_FALSE(a.exhausted());
+      EXPECT_EQ("1-" + std::to_string(i), table.GetEntryText(*a.entry()));
+    }
+    else {
+      EXPECT_TRUE(a.exhausted());
+    }
+    for (int j = 0; j < kNumSyllables; ++j) {
+      rime::Code code(MakeCode({1, i, j}));
+      auto a = table.QueryPhrases(code);
+      if (i % 2 == 0 && j % 3 == 1) {
+        ASSERT_FALSE(a.exhausted());
+        EXPECT_EQ("1-" + std::to_string(i) + "-" + std::to_string(j),
+                  table.GetEntryText(*a.entry()));
+      }
+      else {
+        EXPECT_TRUE(a.exhausted());
+      }
+    }
+  }
+  table.Close();
+  table.Remove();
+}
+
+TEST(RimeTableMappingPolicyTest, SharedTableKeepsEveryHint) {
+  rime::Table table("table_policy_test.bin");
+  rime::MappingPolicy prefetch;
+  prefetch.prefetch = true;
+  rime::MappingPolicy random_access;
+  random_access.random_access = true;
+  table.merge_mapping_policy(prefetch);
+  table.merge_mapping_policy(random_access);
+  table.merge_mapping_policy(rime::MappingPolicy());
+  EXPECT_TRUE(table.mapping_policy().prefetch);
+  EXPECT_TRUE(table.mapping_policy().random_access);
+  EXPECT_FALSE(table.mapping_policy().huge_pages);
+  EXPECT_FALSE(table.mapping_policy().lock);
+}
+
+#ifdef __linux__
+static long CountMajorPageFaults() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_majflt;
+}
+
+// drops the file from the page cache; returns false if any page of it
+// stays resident, as on file systems that ignore the advice.
+static bool EvictFromPageCache(const char* file_name) {
+  int fd = open(file_name, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  fstat(fd, &st);
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t num_pages = (st.st_size + page_size - 1) / page_size;
+  void* address = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (address == MAP_FAILED)
+    return false;
+  std::vector<unsigned char> resident(num_pages);
+  bool evicted = mincore(address, st.st_size, resident.data()) == 0 &&
+      std::none_of(resident.begin(), resident.end(),
+                   [](unsigned char page) { return page & 1; });
+  munmap(address, st.st_size);
+  return evicted;
+}
+
+TEST(RimeTableMappingPolicyTest, MajorPageFaultsOnColdLookup) {
+  const int kNumSyllables = 4096;
+  rime::Syllabary syll;
+  rime::Vocabulary voc;
+  for (int i = 0; i < kNumSyllables; ++i) {
+    syll.insert(std::to_string(10000 + i));
+    auto d = rime::New<rime::DictEntry>();
+    d->code = MakeCode({i});
+    d->text = std::to_string(i);
+    voc[i].entries.push_back(d);
+  }
+  const char* file_name = "table_policy_test.bin";
+  rime::Table table(file_name);
+  table.Remove();
+  ASSERT_TRUE(table.Build(syll, voc, kNumSyllables));
+  ASSERT_TRUE(table.Save());
+  table.Close();
+
+  // major faults in looking up every syllable in a table loaded from disk
+  auto cold_lookups = [&](const rime::MappingPolicy& policy) -> long {
+    table.set_mapping_policy(policy);
+    if (!EvictFromPageCache(file_name))
+      return -1;
+    EXPECT_TRUE(table.Load());
+    long faults = CountMajorPageFaults();
+    for (int i = 0; i < kNumSyllables; ++i) {
+      auto a = table.QueryWords(i);
+      EXPECT_FALSE(a.exhausted()) << "no entry for syllable #" << i;
+    }
+    faults = CountMajorPageFaults() - faults;
+    table.Close();
+    return faults;
+  };
+  long by_default = cold_lookups(rime::MappingPolicy());
+  rime::MappingPolicy random_access;
+  random_access.random_access = true;
+  long without_read_ahead = cold_lookups(random_access);
+  rime::MappingPolicy prefetch = random_access;
+  prefetch.prefetch = true;
+  long with_prefetch = cold_lookups(prefetch);
+  table.Remove();
+  if (by_default < 0 || without_read_ahead < 0 || with_prefetch < 0) {
+    GTEST_SKIP() << "the page cache cannot be dropped for " << file_name;
+  }
+  // random access turns off read-ahead, so the index is read page by page
+  EXPECT_LT(by_default, without_read_ahead);
+  // while prefetching reads the head index in when the table is loaded
+  EXPECT_LT(with_prefetch, without_read_ahead);
+  RecordProperty("major_faults_default", static_cast<int>(by_default));
+  RecordProperty("major_faults_random_access",
+                 static_cast<int>(without_read_ahead));
+  RecordProperty("major_faults_prefetch", static_cast<int>(with_prefetch));
+}
+#endif  // __linux__
+
+TEST_F(RimeTableTest, Sections) {
+  ASSERT_TRUE(table_->Verify());
+  for (uint32_t type : {rime::table::kSyllabarySection,
+                        rime::table::kIndexSection,
+                        rime::table::kRankIndexSection,
+                        rime::table::kStringTableSection}) {
+    auto section = table_->FindSection(type);
+    ASSERT_TRUE(section != nullptr);
+    EXPECT_GT(section->size, 0);
+  }
+  EXPECT_EQ(nullptr, table_->FindSection(rime::SectionType('N', 'O', 'N', 'E')));
+}
+
+TEST(RimeTableSectionTest, DetectsCorruption) {
+  rime::Syllabary syll{"a", "b"};
+  rime::Vocabulary voc;
+  auto d = rime::New<rime::DictEntry>();
+  d->code = MakeCode({0});
+  d->text = "alpha";
+  voc[0].entries.push_back(d);
+  rime::Table table("table_section_test.bin");
+  table.Remove();
+  ASSERT_TRUE(table.Build(syll, voc, 1));
+  ASSERT_TRUE(table.Save());
+  ASSERT_TRUE(table.Load());
+  ASSERT_TRUE(table.Verify());
+  // flip a byte in the index, which is not read when loading the table
+  auto section = table.FindSection(rime::table::kIndexSection);
+  ASSERT_TRUE(section != nullptr);
+  size_t offset = section->data.get() + section->size - 1 -
+      reinterpret_cast<const char*>(table.Find<char>(0));
+  table.Close();
+  {
+    std::fstream file("table_section_test.bin",
+                      std::ios::in | std::ios::out | std::ios::binary);
+    file.seekg(offset);
+    char c = static_cast<char>(file.get());
+    file.seekp(offset);
+    file.put(static_cast<char>(c ^ 0x5a));
+  }
+  ASSERT_TRUE(table.Load());
+  EXPECT_FALSE(table.Verify());
+  table.Close();
+  table.Remove();
+}
+
+TEST(RimeTablePackTest, SharedSyllabaryAndStrings) {
+  rime::Syllabary syll{"a", "b", "c"};
+  auto make_vocabulary = [](const std::vector<rime::string>& texts) {
+    rime::Vocabulary voc;
+    for (size_t i = 0; i < texts.size(); ++i) {
+      auto d = rime::New<rime::DictEntry>();
+      d->code = MakeCode({static_cast<int>(i % 3)});
+      d->text = texts[i];
+      voc[i % 3].entries.push_back(d);
+    }
+    return voc;
+  };
+  auto primary = rime::New<rime::Table>("table_pack_primary.bin");
+  primary->Remove();
+  ASSERT_TRUE(primary->Build(syll, make_vocabulary({"alpha", "beta"}), 2, 42));
+  ASSERT_TRUE(primary->Save());
+  ASSERT_TRUE(primary->Load());
+
+  for (bool share_strings : {false, true}) {
+    auto pack = rime::New<rime::Table>("table_pack_test.bin");
+    pack->Remove();
+    // "beta" is in the primary table, "gamma" is not
+    ASSERT_TRUE(pack->BuildPack(primary,
+                                make_vocabulary({"beta", "gamma", "beta"}),
+                                3, 43, share_strings));
+    ASSERT_TRUE(pack->Save());
+    pack->Close();
+    pack->set_primary_table(nullptr);
+    EXPECT_FALSE(pack->Load());
+    pack->set_primary_table(primary);
+    ASSERT_TRUE(pack->Load());
+    EXPECT_TRUE(pack->Verify());
+    EXPECT_EQ(nullptr, pack->FindSection(rime::table::kSyllabarySection));
+    EXPECT_EQ("c", pack->GetSyllableById(2));
+    const char* expected[] = {"beta", "gamma", "beta"};
+    for (int i = 0; i < 3; ++i) {
+      auto a = pack->QueryWords(i);
+      ASSERT_FALSE(a.exhausted());
+      EXPECT_EQ(expected[i], pack->GetEntryText(*a.entry()));
+    }
+    pack->Close();
+    pack->Remove();
+  }
+  primary->Close();
+  primary->Remove();
 }
@@ -0,0 +1,208 @@
+//
+// Copyright RIME Developers
+// Distributed under the BSD License
+//
+
+#include <chrono>
+#include <iostream>
+#include <gtest/gtest.h>
+#include <rime/candidate.h>
+#include <rime/common.h>
+#include <rime/translation.h>
+
+using namespace rime;
+
+static an<FifoTranslation> MakeTranslation(const vector<string>& texts) {
+  auto translation = New<FifoTranslation>();
+  for (const string& text : texts) {
+    translation->Append(New<SimpleCandidate>("test", 0, 1, text));
+  }
+  return translation;
+}
+
+TEST(RimeTranslationTest, DistinctTranslation) {
+  DistinctTranslation distinct(
+      MakeTranslation({"a", "b", "a", "c", "b", "b", "d", "a"}));
+  vector<string> results;
+  while (!distinct.exhausted()) {
+    results.push_back(distinct.Peek()->text());
+    distinct.Next();
+  }
+  ASSERT_EQ(4, results.size());
+  EXPECT_EQ("a", results[0]);
+  EXPECT_EQ("b", results[1]);
+  EXPECT_EQ("c", results[2]);
+  EXPECT_EQ("d", results[3]);
+}
+
+// creates each candidate as it is requested.
+class GeneratedTranslation : public Translation {
+ public:
+  GeneratedTranslation(const vector<string>& texts) : texts_(texts) {
+    set_exhausted(texts_.empty());
+  }
+  bool Next() {
+    if (exhausted())
+      return false;
+    current_.reset();
+    if (++cursor_ >= texts_.size())
+      set_exhausted(true);
+    return true;
+  }
+  an<Candidate> Peek() {
+    if (exhausted())
+      return nullptr;
+    if (!current_)
+      current_ = New<SimpleCandidate>("test", 0, 1, texts_[cursor_]);
+    return current_;
+  }
+
+ private:
+  vector<string> texts_;
+  size_t cursor_ = 0;
+  an<Candidate> current_;
+};
+
+TEST(RimeTranslationTest, DistinctTranslationKeepsNoCandidates) {
+  DistinctTranslation distinct(
+      New<GeneratedTranslation>(vector<string>{"a", "b", "a", "c"}));
+  weak<Candidate> first = distinct.Peek();
+  distinct.Next();
+  EXPECT_TRUE(first.expired());
+  EXPECT_EQ("b", distinct.Peek()->text());
+  distinct.Next();
+  EXPECT_EQ("c", distinct.Peek()->text());
+}
+
+TEST(RimeTranslationTest, DistinctTranslationOfManyTexts) {
+  const size_t kNumTexts = 10000;
+  vector<string> texts;
+  for (size_t i = 0; i < kNumTexts; ++i) {
+    texts.push_back(std::to_string(i));
+  }
+  // duplicates of the first and the last texts alike are skipped.
+  texts.push_back("0");
+  texts.push_back(std::to_string(kNumTexts - 1));
+  texts.push_back(std::to_string(kNumTexts / 2));
+  DistinctTranslation distinct(New<GeneratedTranslation>(texts));
+  size_t count = 0;
+  while (!distinct.exhausted()) {
+    distinct.Next();
+    ++count;
+  }
+  EXPECT_EQ(kNumTexts, count);
+}
+
+// the former implementation, for comparison.
+class SetDistinctTranslation : public CacheTranslation {
+ public:
+  SetDistinctTranslation(an<Translation> translation)
+      : CacheTranslation(translation) {}
+  bool Next() {
+    if (exhausted())
+      return false;
+    candidate_set_.insert(Peek()->text());
+    do {
+      CacheTranslation::Next();
+    }
+    while (!exhausted() &&
+           candidate_set_.find(Peek()->text()) != candidate_set_.end());
+    return true;
+  }
+
+ private:
+  set<string> candidate_set_;
+};
+
+// phrase-length texts with one duplicate in every four
+static vector<string> MakeTexts() {
+  vector<string> texts;
+  for (int i = 0; i < 1000; ++i) {
+    texts.push_back("\xe8\xaf\x8d\xe8\xaf\xad" + std::to_string(i % 750));
+  }
+  return texts;
+}
+
+template <class T>
+static vector<string> Distinct(const vector<string>& texts) {
+  T distinct(MakeTranslation(texts));
+  vector<string> results;
+  while (!distinct.exhausted()) {
+    results.push_back(distinct.Peek()->text());
+    distinct.Next();
+  }
+  return results;
+}
+
+TEST(RimeTranslationTest, DistinctTranslationAsFormerImplementation) {
+  auto texts = MakeTexts();
+  auto results = Distinct<DistinctTranslation>(texts);
+  EXPECT_EQ(750, results.size());
+  EXPECT_EQ(Distinct<SetDistinctTranslation>(texts), results);
+}
+
+template <class T>
+static double NanosecondsPerCandidate(const vector<string>& texts) {
+  const int kRounds = 200;
+  auto start = std::chrono::steady_clock::now();
+  size_t count = 0;
+  for (int i = 0; i < kRounds; ++i) {
+    T distinct(MakeTranslation(texts));
+    while (!distinct.exhausted()) {
+      distinct.Next();
+      ++count;
+    }
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / count;
+}
+
+// timing only; run with --gtest_also_run_disabled_tests.
+TEST(RimeTranslationTest, DISABLED_DistinctTranslationBenchmark) {
+  auto texts = MakeTexts();
+  double hashed = NanosecondsPerCandidate<DistinctTranslation>(texts);
+  double ordered = NanosecondsPerCandidate<SetDistinctTranslation>(texts);
+  std::cout << "DistinctTranslation: " << hashed << " ns/candidate, "
+            << "set<string>: " << ordered << " ns/candidate" << std::endl;
+}
+
+// gives way to any other translation that still has candidates.
+class ModestTranslation : public UniqueTranslation {
+ public:
+  ModestTranslation(an<Candidate> candidate)
+      : UniqueTranslation(candidate) {}
+  int Compare(an<Translation> other, const CandidateList& candidates) {
+    if (!other || other->exhausted())
+      return -1;
+    return 1;
+  }
+};
+
+static an<Candidate> MakeCandidate(const string& text, double quality) {
+  auto cand = New<SimpleCandidate>("test", 0, 1, text);
+  cand->set_quality(quality);
+  return cand;
+}
+
+TEST(RimeTranslationTest, MergedTranslation) {
+  CandidateList candidates;
+  MergedTranslation merged(candidates);
+  merged += New<ModestTranslation>(MakeCandidate("X", 9.));
+  auto first = New<FifoTranslation>();
+  first->Append(MakeCandidate("A", 1.));
+  first->Append(MakeCandidate("B", 1.));
+  merged += first;
+  auto second = New<FifoTranslation>();
+  second->Append(MakeCandidate("C", 2.));
+  merged += second;
+  EXPECT_EQ(3, merged.size());
+  string results;
+  while (!merged.exhausted()) {
+    auto cand = merged.Peek();
+    ASSERT_TRUE(bool(cand));
+    candidates.push_back(cand);
+    results += cand->text();
+    merged.Next();
+  }
+  EXPECT_EQ("CABX", results);
+}
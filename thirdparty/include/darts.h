@@ -230,6 +230,17 @@ class DoubleArrayImpl {
   int build(std::size_t num_keys, const key_type * const *keys,
       const std::size_t *lengths = NULL, const value_type *values = NULL,
       Details::progress_func_type progress_func = NULL);
+  // build_in_place() works like build() but stores the array of units in
+  // memory obtained from `allocate', which is called once with the number of
+  // bytes needed, e.g. to place the array in a memory-mapped file without
+  // keeping another copy; the builder's units are released chunk by chunk as
+  // they are copied. The array is not freed by clear(), as with
+  // set_array(). build_in_place() returns -1 if `allocate' returns NULL.
+  // `lengths' and `values' are optional as with build().
+  template <typename Allocator>
+  int build_in_place(std::size_t num_keys, const key_type * const *keys,
+      Allocator allocate, const std::size_t *lengths = NULL,
+      const value_type *values = NULL);
 
   // open() reads an array of units from the specified file. And if it goes
   // well, the old array will be freed and replaced with the new array read
@@ -688,6 +699,87 @@ void AutoPool<T>::resize_buf(std::size_t size) {
   capacity_ = capacity;
 }
 
+//
+// Memory management of resizable array in fixed-size chunks.
+//
+
+// ChunkedPool works like AutoPool for elements that are default
+// constructible and trivially copyable, but growing it does not move the
+// elements, and move_to() releases chunks as soon as they are copied, so that
+// at most one chunk is held in addition to the destination.
+template <typename T>
+class ChunkedPool {
+ public:
+  enum { CHUNK_BITS = 16, CHUNK_SIZE = 1 << CHUNK_BITS };
+
+  ChunkedPool() : chunks_(), size_(0) {}
+  ~ChunkedPool() { clear(); }
+
+  const T &operator[](std::size_t id) const {
+    return chunks_[id >> CHUNK_BITS][id & (CHUNK_SIZE - 1)];
+  }
+  T &operator[](std::size_t id) {
+    return chunks_[id >> CHUNK_BITS][id & (CHUNK_SIZE - 1)];
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+  std::size_t size() const {
+    return size_;
+  }
+
+  void clear() {
+    for (std::size_t i = 0; i < chunks_.size(); ++i) {
+      delete[] chunks_[i];
+    }
+    chunks_.clear();
+    size_ = 0;
+  }
+
+  void resize(std::size_t size) {
+    while ((chunks_.size() << CHUNK_BITS) < size) {
+      T *chunk;
+      try {
+        chunk = new T[CHUNK_SIZE];
+      } catch (const std::bad_alloc &) {
+        DARTS_THROW("failed to resize pool: std::bad_alloc");
+      }
+      chunks_.append(chunk);
+    }
+    for (std::size_t i = size_; i < size; ++i) {
+      (*this)[i] = T();
+    }
+    size_ = size;
+  }
+  // chunks are allocated as needed.
+  void reserve(std::size_t) {}
+
+  // copies the elements to `buf' and empties the pool.
+  template <typename U>
+  void move_to(U *buf) {
+    for (std::size_t i = 0; i < chunks_.size(); ++i) {
+      std::size_t begin = i << CHUNK_BITS;
+      std::size_t end = begin + CHUNK_SIZE < size_ ? begin + CHUNK_SIZE : size_;
+      for (std::size_t id = begin; id < end; ++id) {
+        buf[id] = chunks_[i][id - begin];
+      }
+      delete[] chunks_[i];
+      chunks_[i] = NULL;
+    }
+    chunks_.clear();
+    size_ = 0;
+  }
+
+ private:
+  AutoPool<T *> chunks_;
+  std::size_t size_;
+
+  // Disallows copy and assignment.
+  ChunkedPool(const ChunkedPool &);
+  ChunkedPool &operator=(const ChunkedPool &);
+};
+
 //
 // Memory management of stack.
 //
@@ -1425,6 +1517,9 @@ class DoubleArrayBuilder {
   template <typename T>
   void build(const Keyset<T> &keyset);
   void copy(std::size_t *size_ptr, DoubleArrayUnit **buf_ptr) const;
+  void copy_to(DoubleArrayUnit *buf) const;
+  // moves the units to `buf', releasing them as they are copied.
+  void move_to(DoubleArrayUnit *buf);
 
   void clear();
 
@@ -1440,7 +1535,7 @@ class DoubleArrayBuilder {
   typedef DoubleArrayBuilderExtraUnit extra_type;
 
   progress_func_type progress_func_;
-  AutoPool<unit_type> units_;
+  ChunkedPool<unit_type> units_;
   AutoArray<extra_type> extras_;
   AutoPool<uchar_type> labels_;
   AutoArray<id_type> table_;
@@ -1507,13 +1602,21 @@ inline void DoubleArrayBuilder::copy(std::size_t *size_ptr,
   }
   if (buf_ptr != NULL) {
     *buf_ptr = new DoubleArrayUnit[units_.size()];
-    unit_type *units = reinterpret_cast<unit_type *>(*buf_ptr);
-    for (std::size_t i = 0; i < units_.size(); ++i) {
-      units[i] = units_[i];
-    }
+    copy_to(*buf_ptr);
+  }
+}
+
+inline void DoubleArrayBuilder::copy_to(DoubleArrayUnit *buf) const {
+  unit_type *units = reinterpret_cast<unit_type *>(buf);
+  for (std::size_t i = 0; i < units_.size(); ++i) {
+    units[i] = units_[i];
   }
 }
 
+inline void DoubleArrayBuilder::move_to(DoubleArrayUnit *buf) {
+  units_.move_to(reinterpret_cast<unit_type *>(buf));
+}
+
 inline void DoubleArrayBuilder::clear() {
   units_.clear();
   extras_.clear();
@@ -1888,6 +1991,32 @@ int DoubleArrayImpl<A, B, T, C>::build(std::size_t num_keys,
   return 0;
 }
 
+template <typename A, typename B, typename T, typename C>
+template <typename Allocator>
+int DoubleArrayImpl<A, B, T, C>::build_in_place(std::size_t num_keys,
+    const key_type * const *keys, Allocator allocate,
+    const std::size_t *lengths, const value_type *values) {
+  Details::Keyset<value_type> keyset(num_keys, keys, lengths, values);
+
+  Details::DoubleArrayBuilder builder(NULL);
+  builder.build(keyset);
+
+  std::size_t size = 0;
+  builder.copy(&size, NULL);
+  void *buf = allocate(size * unit_size());
+  if (buf == NULL) {
+    return -1;
+  }
+  builder.move_to(static_cast<unit_type *>(buf));
+
+  clear();
+
+  size_ = size;
+  array_ = static_cast<const unit_type *>(buf);
+
+  return 0;
+}
+
 }  // namespace Darts
 
 #undef DARTS_INT_TO_STR
@@ -99,6 +99,10 @@ int main(int argc, char* argv[]) {
               << std::endl
               << "\t--set-active-schema <schema_id>" << std::endl
               << "\t\tSet the active schema in user.yaml" << std::endl
+              << std::endl
+              << "\t--build-grammar <language> <counts.tsv> [user_data_dir] [shared_data_dir] [staging_dir]" << std::endl
+              << "\t\tBuild <language>.ngram.bin for the grammar from n-gram counts." << std::endl
+              << "\t\tEach line of counts.tsv has words separated by spaces, a tab and the count." << std::endl
       ;
 
     return 0;
@@ -135,6 +139,13 @@ int main(int argc, char* argv[]) {
     return update.Run(&deployer) ? 0 : 1;
   }
 
+  if (argc >= 2 && argc <= 5 && option == "--build-grammar") {
+    Deployer& deployer(Service::instance().deployer());
+    setup_deployer(&deployer, argc - 2, argv + 2);
+    GrammarModelUpdate update(argv[0], argv[1]);
+    return update.Run(&deployer) ? 0 : 1;
+  }
+
   std::cerr << "invalid arguments." << std::endl;
   return 1;
 }